@@ -0,0 +1,59 @@
+#!/bin/sh
+# Compare the cost of a full gradient of a function of many parameters computed three ways: one reverse
+# mode pass (grad), one forward mode pass per parameter (deriv), and finite differences, which call the
+# function once more per parameter. Each kernel computes one gradient per index of a parsum and returns the
+# sum of its entries; the grad calls of rev share their arguments, so they are compiled to a single reverse
+# pass. The last run prints the gradient at one point as evaluated by gradient(...), and the sum of its
+# entries by finite differences.
+# Usage: bench/autodiff.sh [path/to/chickadee] [parameters] [gradients]
+
+CHICKADEE=${1:-./chickadee}
+PARAMS=${2:-32}
+COUNT=${3:-200000}
+SCRIPT=${TMPDIR:-/tmp}/chickadee-autodiff.$$.ck
+
+# f is a chained least squares loss over its parameters x0 ... x<n-1>; the kernels evaluate its gradient
+# at the point x<j> = i*0.000001 + j*0.01.
+awk -v n="$PARAMS" 'BEGIN {
+    printf "def sq(t) t*t;\n"
+    params = ""; body = ""; point = ""
+    for (j = 0; j < n; j++) {
+        params = params (j ? " " : "") "x" j
+        point = point (j ? ", " : "") "i*0.000001 + " j * 0.01
+        if (j + 1 < n) {
+            body = body (j ? " + " : "") "sq(x" j "*x" (j + 1) " - " (j % 7) * 0.1 ")"
+        }
+    }
+    printf "def f(%s) %s;\n", params, body
+
+    rev = ""; fwd = ""
+    for (j = 0; j < n; j++) {
+        rev = rev (j ? " + " : "") "grad(f, " j ", " point ")"
+        fwd = fwd (j ? " + " : "") "deriv(f, " j ", " point ")"
+    }
+    printf "def rev(i) %s;\n", rev
+    printf "def fwd(i) %s;\n", fwd
+
+    fd = ""
+    for (j = 0; j < n; j++) {
+        shifted = ""
+        for (k = 0; k < n; k++) {
+            shifted = shifted (k ? ", " : "") "i*0.000001 + " k * 0.01 (k == j ? " + 0.000001" : "")
+        }
+        fd = fd (j ? " + " : "") "(f(" shifted ") - base)*1000000"
+    }
+    printf "def fdsum(i base) %s;\n", fd
+    printf "def fd(i) fdsum(i, f(%s));\n", point
+}' > "$SCRIPT"
+
+for KERNEL in rev fwd fd; do
+    START=$(date +%s.%N)
+    (cat "$SCRIPT"; echo "parsum($KERNEL, 0, $COUNT);") | "$CHICKADEE" --threads=1 > /dev/null 2>&1
+    END=$(date +%s.%N)
+    echo "$KERNEL: $(echo "$END - $START" | bc) s for $COUNT gradients of $PARAMS parameters"
+done
+
+POINT=$(awk -v n="$PARAMS" 'BEGIN { for (j = 0; j < n; j++) printf "%s%s", (j ? ", " : ""), 1 + j * 0.01 }')
+(cat "$SCRIPT"; echo "gradient(f, $POINT);"; echo "fdsum(1000000, f($POINT));") | "$CHICKADEE" 2>&1 \
+    | grep -o "Evaluated to .*"
+rm -f "$SCRIPT"
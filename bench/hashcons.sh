@@ -0,0 +1,24 @@
+#!/bin/sh
+# Compile a machine-generated formula full of repeated subtrees with and without hash-consing,
+# and print the IR size and compile time reported by :codegen.
+# Usage: bench/hashcons.sh [path/to/chickadee] [depth]
+
+CHICKADEE=${1:-./chickadee}
+DEPTH=${2:-7}
+
+# e(0) = x*y + 1,  e(k) = (e(k-1) * e(k-1) + e(k-1)) * (e(k-1) - y); the tree grows as 4^depth.
+FORMULA=$(awk -v depth="$DEPTH" 'BEGIN {
+    e = "(x*y + 1)"
+    for (k = 1; k <= depth; k++) {
+        e = "((" e "*" e " + " e ")*(" e " - y))"
+    }
+    print e
+}')
+
+INPUT=$(printf 'def f(x y) %s;\n:codegen\n' "$FORMULA")
+
+echo "=== depth $DEPTH, $(printf '%s' "$FORMULA" | wc -c) bytes of source"
+echo "--- tree"
+printf '%s\n' "$INPUT" | "$CHICKADEE" --no-peval 2>&1 | grep -A2 'codegen:'
+echo "--- hash-consed"
+printf '%s\n' "$INPUT" | "$CHICKADEE" --no-peval --hash-cons 2>&1 | grep -A2 'codegen:'
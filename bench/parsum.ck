@@ -0,0 +1,7 @@
+# Parallel scaling benchmark: a compute-bound function summed over a large index range.
+# Use bench/scaling.sh to run it with increasing thread counts.
+
+def step(x) x*0.999 + 0.001*x*x - 0.0001*x*x*x;
+def work(i) step(step(step(step(step(step(step(step(i*0.000001))))))));
+
+parsum(work, 0, 200000000);
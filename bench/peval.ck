@@ -0,0 +1,20 @@
+# Partial evaluation benchmark.
+# Run with and without partial evaluation and compare the ':peval' report:
+#   chickadee < bench/peval.ck
+#   chickadee --no-peval < bench/peval.ck
+
+def poly(x y) x*x*x + 3*x*x*y - 2*x*y*y + y*y*y + 7;
+def scale(k x) poly(k, x) * poly(x, k) + k*k;
+
+# Fully constant: folded into a literal at definition time.
+def table() scale(2, 3) + scale(3, 4) + scale(4, 5);
+
+# Partially constant: calls are redirected to clones specialized on k.
+def sweep(x) scale(2, x) + scale(2, x + 1) + scale(3, x);
+
+table();
+sweep(1.5);
+sweep(2.5);
+scale(2, 3) + scale(2, 3);
+
+:peval
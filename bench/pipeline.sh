@@ -0,0 +1,39 @@
+#!/bin/sh
+# Load a machine-generated script of definitions and expressions with the sequential and the
+# pipelined main loop, and print the end-to-end time and throughput of each. Both runs must
+# print the same output.
+# Usage: bench/pipeline.sh [path/to/chickadee] [definitions]
+
+CHICKADEE=${1:-./chickadee}
+COUNT=${2:-2000}
+SCRIPT=${TMPDIR:-/tmp}/chickadee-pipeline.$$.ck
+
+# f<i>(x y) is a polynomial of a few dozen terms, followed by an expression that calls it.
+awk -v count="$COUNT" 'BEGIN {
+    for (i = 0; i < count; i++) {
+        body = "x"
+        for (k = 1; k <= 24; k++) {
+            body = body " + " (i + k) "*x*y - y*" k
+        }
+        printf "def f%d(x y) %s;\n", i, body
+        printf "f%d(%d, 2);\n", i, i
+    }
+}' > "$SCRIPT"
+
+echo "=== $COUNT definitions, $(wc -c < "$SCRIPT") bytes of source"
+for MODE in sequential pipelined; do
+    FLAGS=
+    if [ "$MODE" = pipelined ]; then
+        FLAGS=--pipeline
+    fi
+
+    START=$(date +%s.%N)
+    "$CHICKADEE" $FLAGS < "$SCRIPT" > "$SCRIPT.$MODE" 2>&1
+    END=$(date +%s.%N)
+    echo "$MODE: $(echo "$END - $START" | bc) s, $(echo "2 * $COUNT / ($END - $START)" | bc) items/s"
+done
+
+if ! cmp -s "$SCRIPT.sequential" "$SCRIPT.pipelined"; then
+    echo "output differs between the sequential and the pipelined run"
+fi
+rm -f "$SCRIPT" "$SCRIPT.sequential" "$SCRIPT.pipelined"
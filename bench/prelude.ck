@@ -0,0 +1,7 @@
+# A prelude for the evaluation server: compiled once, linked into every session.
+# Usage: chickadee --server=/tmp/chickadee.sock --prelude=bench/prelude.ck
+
+def poly(x) x*x*x + 2*x*x + 3*x + 4;
+def square(x) x*x;
+def sumsq(a b) square(a) + square(b);
+def memo norm2(a b) sumsq(a, b);
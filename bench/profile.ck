@@ -0,0 +1,13 @@
+# Profiler benchmark: a call-heavy function next to one that does more work per call.
+# Use bench/profile.sh to measure the instrumentation overhead, or look at the report:
+#   chickadee --profile < bench/profile.ck
+
+def step(x) x*0.999 + 0.001*x*x;
+def poly(x) x*x*x*x + 3*x*x*x - 2*x*x + 7*x - 1 + x*x*x*x*x*0.5 - x*x*x*x*x*x*0.25;
+def small(i) step(step(step(step(i*0.000001))));
+def large(i) poly(i*0.000001) * poly(i*0.000002) + poly(i*0.000003);
+
+parsum(small, 0, 20000000);
+parsum(large, 0, 20000000);
+
+:profile
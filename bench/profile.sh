@@ -0,0 +1,23 @@
+#!/bin/sh
+# Time the benchmark workloads with and without the instrumenting profiler, and print the
+# overhead, followed by the report of bench/profile.ck.
+# Usage: bench/profile.sh [path/to/chickadee]
+
+CHICKADEE=${1:-./chickadee}
+DIR=$(dirname "$0")
+
+seconds() {
+    START=$(date +%s.%N)
+    "$CHICKADEE" "$@" > /dev/null 2>&1
+    END=$(date +%s.%N)
+    echo "$END - $START" | bc
+}
+
+for WORKLOAD in profile parsum peval; do
+    PLAIN=$(seconds --threads=1 < "$DIR/$WORKLOAD.ck")
+    PROFILED=$(seconds --threads=1 --profile < "$DIR/$WORKLOAD.ck")
+    echo "$WORKLOAD.ck: $PLAIN s, profiled $PROFILED s ($(echo "scale=2; $PROFILED / $PLAIN" | bc)x)"
+done
+
+echo
+"$CHICKADEE" --threads=1 --profile < "$DIR/profile.ck" 2>&1 | sed -n '/cycles\/call/,$p'
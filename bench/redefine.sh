@@ -0,0 +1,29 @@
+#!/bin/sh
+# Redefine a function that other definitions call, and a memoized one, thousands of times in one
+# session, and print the :memory report along the way. With superseded code being collected, the
+# number of live modules and the bytes they take stay flat instead of growing with every redefinition.
+# Usage: bench/redefine.sh [path/to/chickadee] [redefinitions]
+
+CHICKADEE=${1:-./chickadee}
+COUNT=${2:-5000}
+SCRIPT=${TMPDIR:-/tmp}/chickadee-redefine.$$.ck
+
+awk -v count="$COUNT" 'BEGIN {
+    print "def f(x) x;"
+    print "def g(x) f(x) * 2;"
+    print "def h(x y) g(x) + g(y);"
+    for (i = 1; i <= count; i++) {
+        printf "def f(x) x + %d;\n", i
+        printf "def memo m(x) x * %d;\n", i
+        printf "h(%d, 1) + m(2);\n", i
+        if (i % (count / 5) == 0) {
+            print ":memory"
+        }
+    }
+}' > "$SCRIPT"
+
+START=$(date +%s.%N)
+"$CHICKADEE" < "$SCRIPT" 2>&1 | grep -A1 "memory:"
+END=$(date +%s.%N)
+echo "$COUNT redefinitions in $(echo "$END - $START" | bc) s"
+rm -f "$SCRIPT"
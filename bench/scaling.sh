@@ -0,0 +1,16 @@
+#!/bin/sh
+# Time bench/parsum.ck for 1, 2, 4, ... threads up to the number of cores.
+# Usage: bench/scaling.sh [path/to/chickadee]
+
+CHICKADEE=${1:-./chickadee}
+DIR=$(dirname "$0")
+CORES=$(getconf _NPROCESSORS_ONLN)
+
+THREADS=1
+while [ "$THREADS" -le "$CORES" ]; do
+    START=$(date +%s.%N)
+    "$CHICKADEE" --threads="$THREADS" < "$DIR/parsum.ck" > /dev/null 2>&1
+    END=$(date +%s.%N)
+    echo "$THREADS threads: $(echo "$END - $START" | bc) s"
+    THREADS=$((THREADS * 2))
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Measure the evaluation server under 1, 2, 4, ... concurrent sessions up to the number of cores,
+# once defining the workload in every session and once taking it from the shared prelude.
+# Partial evaluation is off, since it would fold the constant requests of the load generator at
+# compile time, and the JIT'd code would never run.
+# Usage: bench/server.sh [path/to/chickadee] [path/to/chickadee-loadgen]
+
+CHICKADEE=${1:-./chickadee}
+LOADGEN=${2:-./chickadee-loadgen}
+DIR=$(dirname "$0")
+SOCKET=${TMPDIR:-/tmp}/chickadee-bench.$$.sock
+CORES=$(getconf _NPROCESSORS_ONLN)
+
+run() {
+    "$CHICKADEE" --server="$SOCKET" --server-threads="$CORES" --no-peval "$@" 2> /dev/null &
+    SERVER=$!
+    while [ ! -S "$SOCKET" ]; do sleep 0.1; done
+
+    CLIENTS=1
+    while [ "$CLIENTS" -le "$CORES" ]; do
+        echo "--- $CLIENTS client(s)"
+        "$LOADGEN" "$SOCKET" -c "$CLIENTS" -n 2000 $SETUP
+        CLIENTS=$((CLIENTS * 2))
+    done
+
+    kill "$SERVER"
+    wait "$SERVER" 2> /dev/null
+    rm -f "$SOCKET"
+}
+
+echo "=== workload defined per session"
+SETUP=
+run
+
+echo "=== workload from the prelude"
+SETUP="-s ;"
+run --prelude="$DIR/prelude.ck"
@@ -0,0 +1,17 @@
+# Vector benchmark: the same four-lane polynomial kernel written with scalars and with vec4.
+# The IR printed for vpoly shows <4 x double> operations; compare the run times with
+#   chickadee --threads=1 < bench/simd.ck
+
+def spoly(x) x*x*x*0.5 - x*x*0.25 + x*0.125 + 1;
+def scalar(i) spoly(i*0.000001) + spoly(i*0.000002) + spoly(i*0.000003) + spoly(i*0.000004);
+
+def vpoly(x:vec4) x*x*x*0.5 - x*x*0.25 + x*0.125 + 1;
+def vector(i) hsum(vpoly(vec4(i*0.000001, i*0.000002, i*0.000003, i*0.000004)));
+
+parsum(scalar, 0, 50000000);
+parsum(vector, 0, 50000000);
+
+# Lane access and the other reductions.
+lane(vpoly(vec4(1, 2, 3, 4)), 2);
+hmin(vec4(3, 1, 4, 1)) + hmax(vec2(5, 9));
+vec4(1, 2, 3, 4) < vec4(2);
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Build a session of machine-generated definitions, save it with :save, and compare how long it
+# takes to get that session back by running the script again against restoring the snapshot.
+# Both sessions must evaluate the same expression to the same value.
+# Usage: bench/snapshot.sh [path/to/chickadee] [definitions]
+
+CHICKADEE=${1:-./chickadee}
+COUNT=${2:-2000}
+SCRIPT=${TMPDIR:-/tmp}/chickadee-snapshot.$$.ck
+SNAPSHOT=${TMPDIR:-/tmp}/chickadee-snapshot.$$.snap
+
+# f<i>(x y) is a polynomial of a few dozen terms; every tenth one also calls its predecessor.
+awk -v count="$COUNT" 'BEGIN {
+    for (i = 0; i < count; i++) {
+        body = "x"
+        for (k = 1; k <= 24; k++) {
+            body = body " + " (i + k) "*x*y - y*" k
+        }
+        if (i % 10 == 9) {
+            body = body " + f" (i - 1) "(y, x)"
+        }
+        printf "def f%d(x y) %s;\n", i, body
+    }
+}' > "$SCRIPT"
+EXPR="f$((COUNT - 1))(3, 2);"
+
+echo "=== $COUNT definitions, $(wc -c < "$SCRIPT") bytes of source"
+START=$(date +%s.%N)
+COLD=$( (cat "$SCRIPT"; echo "$EXPR"; echo ":save") | "$CHICKADEE" --snapshot="$SNAPSHOT" 2>&1)
+END=$(date +%s.%N)
+echo "from source: $(echo "$END - $START" | bc) s"
+echo "$COLD" | grep -o "Saved .*"
+echo "snapshot: $(wc -c < "$SNAPSHOT") bytes"
+
+START=$(date +%s.%N)
+WARM=$(echo "$EXPR" | "$CHICKADEE" --snapshot="$SNAPSHOT" 2>&1)
+END=$(date +%s.%N)
+echo "from snapshot: $(echo "$END - $START" | bc) s"
+echo "$WARM" | grep -o "Loaded .*"
+
+if [ "$(echo "$COLD" | grep -o "Evaluated to .*")" != "$(echo "$WARM" | grep -o "Evaluated to .*")" ]; then
+    echo "the restored session evaluates $EXPR differently"
+fi
+rm -f "$SCRIPT" "$SNAPSHOT"
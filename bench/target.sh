@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compare code generated for the host CPU with code for the x86-64 baseline, with and without tiered
+# compilation, and with hot functions multiversioned on top of the baseline. :target shows what each
+# configuration compiles for and which variants this host can run.
+# Usage: bench/target.sh [path/to/chickadee]
+
+CHICKADEE=${1:-./chickadee}
+SCRIPT=$(dirname "$0")/simd.ck
+
+run() {
+    echo "=== $*"
+    echo ":target" | "$CHICKADEE" "$@" 2>&1 | grep -E '^(target:|  )'
+    START=$(date +%s.%N)
+    "$CHICKADEE" --threads=1 "$@" < "$SCRIPT" > /dev/null 2>&1
+    END=$(date +%s.%N)
+    echo "time: $(echo "$END - $START" | bc) s"
+}
+
+run
+run --cpu=x86-64
+run --tiered
+run --tiered --cpu=x86-64
+run --tiered --cpu=x86-64 --multiversion
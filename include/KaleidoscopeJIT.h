@@ -19,71 +19,321 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbolFlags.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/RuntimeDyld.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/JITSymbol.h"
-#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
 #include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Mangler.h"
+#include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/DynamicLibrary.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include <algorithm>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
 namespace llvm {
     namespace orc {
 
+        // Observes objects as they are linked into and removed from a JIT, e.g. to tell
+        // profilers and debuggers about JIT'd code. Key identifies the object across both calls.
+        class JITObjectObserver {
+        public:
+            virtual ~JITObjectObserver() {}
+            virtual void objectLoaded(const void *Key, const object::ObjectFile &Obj,
+                                      const RuntimeDyld::LoadedObjectInfo &Info) = 0;
+            virtual void objectRemoved(const void *Key) = 0;
+        };
+
+        // A SectionMemoryManager that counts the bytes allocated for the sections of a module.
+        class CountingMemoryManager : public SectionMemoryManager {
+        public:
+            explicit CountingMemoryManager(uint64_t &Bytes) : Bytes(Bytes) {}
+
+            uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                         StringRef SectionName) override {
+                Bytes += Size;
+                return SectionMemoryManager::allocateCodeSection(Size, Alignment, SectionID, SectionName);
+            }
+
+            uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                         StringRef SectionName, bool IsReadOnly) override {
+                Bytes += Size;
+                return SectionMemoryManager::allocateDataSection(Size, Alignment, SectionID, SectionName,
+                                                                 IsReadOnly);
+            }
+
+        private:
+            uint64_t &Bytes;
+        };
+
         class KaleidoscopeJIT {
+            // Forwards the objects of every set that is linked to the observer, if there is one.
+            struct NotifyObjectLoaded {
+                KaleidoscopeJIT *JIT;
+
+                template <typename ObjSetT, typename LoadResult>
+                void operator()(ObjectLinkingLayerBase::ObjSetHandleT H, const ObjSetT &Objects,
+                                const LoadResult &Infos) {
+                    if (!JIT->Observer)
+                        return;
+                    for (size_t I = 0; I != Infos.size(); ++I)
+                        JIT->Observer->objectLoaded(H->get(), *Objects[I], *Infos[I]);
+                }
+            };
+
         public:
-            typedef ObjectLinkingLayer<> ObjLayerT;
-            typedef IRCompileLayer<ObjLayerT> CompileLayerT;
-            typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
+            typedef ObjectLinkingLayer<NotifyObjectLoaded> ObjLayerT;
+            typedef ObjLayerT::ObjSetHandleT ModuleHandleT;
 
-            KaleidoscopeJIT()
-                    : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
-                      CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
+            // Generate code for the given CPU and features, e.g. "+avx2"; by default, for a
+            // generic CPU of the host's architecture.
+            explicit KaleidoscopeJIT(const std::string &CPU = "",
+                                     const std::vector<std::string> &Features = std::vector<std::string>())
+                    : TM(EngineBuilder().setMCPU(CPU).setMAttrs(Features).selectTarget()),
+                      DL(TM->createDataLayout()),
+                      ObjectLayer(NotifyObjectLoaded{this}) {
                 llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
             }
 
+            ~KaleidoscopeJIT() {
+                if (Observer)
+                    for (auto &Info : Modules)
+                        Observer->objectRemoved(Info.first);
+            }
+
             TargetMachine &getTargetMachine() { return *TM; }
 
             ModuleHandleT addModule(std::unique_ptr<Module> M) {
-                // We need a memory manager to allocate memory and resolve symbols for this
-                // new module. Create one that resolves symbols by looking back into the
-                // JIT.
-                auto Resolver = createLambdaResolver(
-                        [&](const std::string &Name) {
-                            if (auto Sym = findMangledSymbol(Name))
-                                return Sym.toRuntimeDyldSymbol();
-                            return RuntimeDyld::SymbolInfo(nullptr);
-                        },
-                        [](const std::string &S) { return nullptr; });
-                auto H = CompileLayer.addModuleSet(singletonSet(std::move(M)),
-                                                   make_unique<SectionMemoryManager>(),
-                                                   std::move(Resolver));
+                // Record what the module defines and refers to before it is compiled.
+                std::unique_ptr<ModuleInfo> Info(new ModuleInfo());
+                auto Record = [&](const GlobalValue &GV) {
+                    if (GV.isDeclaration())
+                        Info->References.insert(mangle(GV.getName()));
+                    else if (!GV.hasLocalLinkage())
+                        Info->Definitions.insert(mangle(GV.getName()));
+                };
+                for (auto &F : *M)
+                    if (!F.isIntrinsic())
+                        Record(F);
+                for (auto &G : M->globals())
+                    Record(G);
+                for (auto &A : M->aliases())
+                    Record(A);
 
-                ModuleHandles.push_back(H);
-                return H;
+                // The object is kept along with the handle: observers refer to it until the
+                // module is removed, and snapshots of the session save it.
+                Info->Owned.reset(new object::OwningBinary<object::ObjectFile>(SimpleCompiler(*TM)(*M)));
+                if (!Info->Owned->getBinary())
+                    report_fatal_error("Cannot compile module " + M->getModuleIdentifier());
+                if (Cache)
+                    Cache->notifyObjectCompiled(M.get(), Info->Owned->getBinary()->getMemoryBufferRef());
+
+                const object::ObjectFile &Obj = *Info->Owned->getBinary();
+                return linkObject(Obj, std::move(Info));
+            }
+
+            // Link an object that was compiled elsewhere, e.g. by another JIT instance. The
+            // object must outlive the handle; its symbols are resolved against this JIT, so
+            // the same object can be added to any number of JITs.
+            ModuleHandleT addObject(const object::ObjectFile &Obj) {
+                std::unique_ptr<ModuleInfo> Info(new ModuleInfo());
+                for (auto &Sym : Obj.symbols()) {
+                    uint32_t Flags = Sym.getFlags();
+                    Expected<StringRef> Name = Sym.getName();
+                    if (!Name) {
+                        consumeError(Name.takeError());
+                        continue;
+                    }
+                    if (Flags & object::SymbolRef::SF_Undefined)
+                        Info->References.insert(*Name);
+                    else if (Flags & object::SymbolRef::SF_Global)
+                        Info->Definitions.insert(*Name);
+                }
+                return linkObject(Obj, std::move(Info));
+            }
+
+            // Let Cache see the object code of every module compiled from now on; null stops it.
+            void setObjectCache(ObjectCache *NewCache) {
+                Cache = NewCache;
+            }
+
+            // Tell Observer about every object linked from now on. Must be set before any module
+            // is added.
+            void setObjectObserver(JITObjectObserver *NewObserver) {
+                Observer = NewObserver;
             }
 
             void removeModule(ModuleHandleT H) {
-                ModuleHandles.erase(
-                        std::find(ModuleHandles.begin(), ModuleHandles.end(), H));
-                CompileLayer.removeModuleSet(H);
+                const void *Key = H->get();
+                auto Info = Modules.find(Key);
+                for (auto &Name : Info->second->Definitions) {
+                    auto Definers = SymbolModules.find(Name);
+                    Definers->second.erase(
+                            std::find(Definers->second.begin(), Definers->second.end(), Key));
+                    if (Definers->second.empty())
+                        SymbolModules.erase(Definers);
+                }
+                for (auto &Name : Info->second->References)
+                    if (--ReferenceCounts[Name] == 0)
+                        ReferenceCounts.erase(Name);
+
+                if (Observer)
+                    Observer->objectRemoved(Key);
+                ObjectLayer.removeObjectSet(H);
+                Modules.erase(Info);
+            }
+
+            // Keep the newest definition of To alive for as long as From is referenced, for
+            // references that are not visible in the code, such as the target of a tier slot.
+            void addSymbolReference(const std::string &From, const std::string &To) {
+                HiddenReferences[mangle(From)].insert(mangle(To));
+            }
+
+            // Whether any linked module defines the named symbol.
+            bool isSymbolDefined(const std::string &Name) {
+                return SymbolModules.count(mangle(Name)) != 0;
+            }
+
+            // Whether any linked module refers to the named symbol.
+            bool isSymbolReferenced(const std::string &Name) {
+                return ReferenceCounts.count(mangle(Name)) != 0;
+            }
+
+            // Remove every module that cannot be reached from the newest definitions of the root
+            // functions through the symbols the modules refer to, e.g. superseded definitions and
+            // the specializations and optimized code that only they used. References are taken
+            // to bind to the newest definition of a symbol, which holds as long as the callers of
+            // a redefined function are recompiled. No code of a removed module may be running.
+            // Returns the number of modules removed and adds the bytes they took to Bytes.
+            unsigned collectGarbage(const std::vector<std::string> &Roots, uint64_t &Bytes) {
+                std::set<const void *> Live;
+                std::set<std::string> Seen;
+                std::vector<std::string> Worklist;
+                for (auto &Root : Roots)
+                    Worklist.push_back(mangle(Root));
+
+                while (!Worklist.empty()) {
+                    std::string Name = std::move(Worklist.back());
+                    Worklist.pop_back();
+                    if (!Seen.insert(Name).second)
+                        continue;
+
+                    auto Hidden = HiddenReferences.find(Name);
+                    if (Hidden != HiddenReferences.end())
+                        Worklist.insert(Worklist.end(), Hidden->second.begin(), Hidden->second.end());
+
+                    auto Definers = SymbolModules.find(Name);
+                    if (Definers == SymbolModules.end())
+                        continue;
+                    const void *Key = Definers->second.back();
+                    if (Live.insert(Key).second)
+                        Worklist.insert(Worklist.end(), Modules[Key]->References.begin(),
+                                        Modules[Key]->References.end());
+                }
+
+                std::vector<ModuleHandleT> Dead;
+                for (auto &Info : Modules) {
+                    if (!Live.count(Info.first)) {
+                        Dead.push_back(Info.second->Handle);
+                        Bytes += Info.second->Bytes;
+                    }
+                }
+                for (auto H : Dead)
+                    removeModule(H);
+
+                // Hidden references from symbols that nothing refers to anymore are dead too.
+                for (auto Hidden = HiddenReferences.begin(); Hidden != HiddenReferences.end();) {
+                    if (ReferenceCounts.count(Hidden->first) || SymbolModules.count(Hidden->first))
+                        ++Hidden;
+                    else
+                        Hidden = HiddenReferences.erase(Hidden);
+                }
+                return static_cast<unsigned>(Dead.size());
+            }
+
+            // The objects of all linked modules, in the order they were added.
+            std::vector<const object::ObjectFile *> getObjects() const {
+                std::vector<const ModuleInfo *> Infos;
+                for (auto &Info : Modules)
+                    Infos.push_back(Info.second.get());
+                std::sort(Infos.begin(), Infos.end(), [](const ModuleInfo *A, const ModuleInfo *B) {
+                    return A->Sequence < B->Sequence;
+                });
+
+                std::vector<const object::ObjectFile *> Objects;
+                for (auto *Info : Infos)
+                    Objects.push_back(Info->Object);
+                return Objects;
+            }
+
+            // The number of linked modules, and the bytes their code and data take once linked.
+            size_t getModuleCount() const { return Modules.size(); }
+            uint64_t getModuleBytes() const {
+                uint64_t Bytes = 0;
+                for (auto &Info : Modules)
+                    Bytes += Info.second->Bytes;
+                return Bytes;
             }
 
             JITSymbol findSymbol(const std::string Name) {
                 return findMangledSymbol(mangle(Name));
             }
 
+            // Register a host address under the given name, so that JIT'd code can refer
+            // to runtime data (such as memoization caches) through an external symbol
+            // instead of baking process-specific addresses into the generated code.
+            void addRuntimeSymbol(const std::string &Name, void *Addr) {
+                RuntimeSymbols[mangle(Name)] = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(Addr));
+            }
+
+            void removeRuntimeSymbol(const std::string &Name) {
+                RuntimeSymbols.erase(mangle(Name));
+            }
+
         private:
+            // What a linked module defines and refers to, by mangled name, and the bytes it takes.
+            struct ModuleInfo {
+                ModuleHandleT Handle;
+                uint64_t Sequence;
+                const object::ObjectFile *Object;
+                // The object, if the JIT compiled it itself.
+                std::unique_ptr<object::OwningBinary<object::ObjectFile>> Owned;
+                std::set<std::string> Definitions;
+                std::set<std::string> References;
+                uint64_t Bytes = 0;
+            };
+
+            ModuleHandleT linkObject(const object::ObjectFile &Obj, std::unique_ptr<ModuleInfo> Info) {
+                // We need a memory manager to allocate memory and resolve symbols for this
+                // new module. Create one that resolves symbols by looking back into the
+                // JIT, and counts the memory the module takes.
+                auto H = ObjectLayer.addObjectSet(singletonSet(&Obj),
+                                                  make_unique<CountingMemoryManager>(Info->Bytes),
+                                                  createResolver());
+                Info->Object = &Obj;
+                registerModule(H, std::move(Info));
+                return H;
+            }
+
+            void registerModule(ModuleHandleT H, std::unique_ptr<ModuleInfo> Info) {
+                Info->Handle = H;
+                Info->Sequence = NextSequence++;
+                for (auto &Name : Info->Definitions)
+                    SymbolModules[Name].push_back(H->get());
+                for (auto &Name : Info->References)
+                    ++ReferenceCounts[Name];
+                Modules[H->get()] = std::move(Info);
+            }
+
             std::string mangle(const std::string &Name) {
                 std::string MangledName;
                 {
@@ -93,6 +343,16 @@ namespace llvm {
                 return MangledName;
             }
 
+            std::unique_ptr<RuntimeDyld::SymbolResolver> createResolver() {
+                return createLambdaResolver(
+                        [&](const std::string &Name) {
+                            if (auto Sym = findMangledSymbol(Name))
+                                return Sym.toRuntimeDyldSymbol();
+                            return RuntimeDyld::SymbolInfo(nullptr);
+                        },
+                        [](const std::string &S) { return nullptr; });
+            }
+
             template <typename T> static std::vector<T> singletonSet(T t) {
                 std::vector<T> Vec;
                 Vec.push_back(std::move(t));
@@ -100,12 +360,19 @@ namespace llvm {
             }
 
             JITSymbol findMangledSymbol(const std::string &Name) {
-                // Search modules in reverse order: from last added to first added.
-                // This is the opposite of the usual search order for dlsym, but makes more
-                // sense in a REPL where we want to bind to the newest available definition.
-                for (auto H : make_range(ModuleHandles.rbegin(), ModuleHandles.rend()))
-                    if (auto Sym = CompileLayer.findSymbolIn(H, Name, false /* <-- http://stackoverflow.com/a/33717957/195651 */))
-                        return Sym;
+                // Runtime data registered by the host takes precedence over everything else.
+                auto RS = RuntimeSymbols.find(Name);
+                if (RS != RuntimeSymbols.end())
+                    return JITSymbol(RS->second, JITSymbolFlags::Exported);
+
+                // Search the modules that define the symbol in reverse order: from last added to
+                // first added. This is the opposite of the usual search order for dlsym, but makes
+                // more sense in a REPL where we want to bind to the newest available definition.
+                auto Definers = SymbolModules.find(Name);
+                if (Definers != SymbolModules.end())
+                    for (auto Key : make_range(Definers->second.rbegin(), Definers->second.rend()))
+                        if (auto Sym = ObjectLayer.findSymbolIn(Modules[Key]->Handle, Name, false /* <-- http://stackoverflow.com/a/33717957/195651 */))
+                            return Sym;
 
                 // If we can't find the symbol in the JIT, try looking in the host process.
                 if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
@@ -117,8 +384,15 @@ namespace llvm {
             std::unique_ptr<TargetMachine> TM;
             const DataLayout DL;
             ObjLayerT ObjectLayer;
-            CompileLayerT CompileLayer;
-            std::vector<ModuleHandleT> ModuleHandles;
+            std::map<const void *, std::unique_ptr<ModuleInfo>> Modules;
+            uint64_t NextSequence = 0;
+            // The modules that define each symbol, oldest first.
+            std::map<std::string, std::vector<const void *>> SymbolModules;
+            std::map<std::string, unsigned> ReferenceCounts;
+            std::map<std::string, std::set<std::string>> HiddenReferences;
+            std::map<std::string, uint64_t> RuntimeSymbols;
+            ObjectCache *Cache = nullptr;
+            JITObjectObserver *Observer = nullptr;
         };
 
     } // end namespace orc
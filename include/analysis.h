@@ -0,0 +1,25 @@
+//
+// Call graph and purity analysis over the expression tree.
+//
+
+#ifndef CHICKADEE_ANALYSIS_H
+#define CHICKADEE_ANALYSIS_H
+
+#include <set>
+#include <string>
+#include "ast.h"
+
+using namespace std;
+
+//! PureFunctions - The names of all definitions that are known to be free of side effects.
+//! A definition is pure if every function it calls is either itself or another pure definition;
+//! externs are never considered pure, since they may call back into the host.
+extern thread_local set<string> PureFunctions;
+
+//! collectCallees - Gather the names of all functions called from within an expression.
+void collectCallees(const ExprAST &E, set<string> &Callees);
+
+//! isPureBody - Determine whether a definition named Name with the given body has no side effects.
+bool isPureBody(const string &Name, const ExprAST &Body);
+
+#endif //CHICKADEE_ANALYSIS_H
@@ -10,15 +10,34 @@
 #include <vector>
 
 #include <llvm/IR/Value.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/Support/Casting.h>
 
 using namespace std;
 using namespace llvm;
 
 //! ExprAST - Base class for all expression nodes.
+//! The kind tag enables LLVM-style isa<>/dyn_cast<> on the node hierarchy for
+//! the analysis passes that walk the tree outside of codegen().
 class ExprAST {
 public:
+    enum ExprKind {
+        EK_Number,
+        EK_Variable,
+        EK_Binary,
+        EK_Call,
+        EK_Shared,
+    };
+
+    ExprAST(ExprKind Kind) : _kind(Kind) {}
     virtual ~ExprAST() {}
     virtual Value *codegen() = 0;
+
+    ExprKind getKind() const { return _kind; }
+
+private:
+    const ExprKind _kind;
 };
 
 //! NumberExprAST - Expression class for numeric literals like "1.0".
@@ -26,8 +45,12 @@ class NumberExprAST : public ExprAST {
     double _val;
 
 public:
-    NumberExprAST(double Val) : _val(Val) {}
+    NumberExprAST(double Val) : ExprAST(EK_Number), _val(Val) {}
     Value *codegen() override;
+
+    double getValue() const { return _val; }
+
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Number; }
 };
 
 //! VariableExprAST - Expression class for referencing a variable, like "a".
@@ -35,8 +58,12 @@ class VariableExprAST : public ExprAST {
     string _name;
 
 public:
-    VariableExprAST(const string &Name) : _name(Name) {}
+    VariableExprAST(const string &Name) : ExprAST(EK_Variable), _name(Name) {}
     Value *codegen() override;
+
+    const string &getName() const { return _name; }
+
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Variable; }
 };
 
 //! BinaryExprAST - Expression class for a binary operator.
@@ -46,8 +73,14 @@ class BinaryExprAST : public ExprAST {
 
 public:
     BinaryExprAST(char op, unique_ptr<ExprAST> LHS, unique_ptr<ExprAST> RHS)
-            : _op(op), LHS(move(LHS)), RHS(move(RHS)) {}
+            : ExprAST(EK_Binary), _op(op), LHS(move(LHS)), RHS(move(RHS)) {}
     Value *codegen() override;
+
+    char getOp() const { return _op; }
+    const ExprAST &getLHS() const { return *LHS; }
+    const ExprAST &getRHS() const { return *RHS; }
+
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Binary; }
 };
 
 //! CallExprAST - Expression class for function calls.
@@ -57,34 +90,99 @@ class CallExprAST : public ExprAST {
 
 public:
     CallExprAST(const string &Callee, vector<unique_ptr<ExprAST>> Args)
-            : _callee(Callee), _args(std::move(Args)) {}
+            : ExprAST(EK_Call), _callee(Callee), _args(std::move(Args)) {}
     Value *codegen() override;
+
+    const string &getCallee() const { return _callee; }
+    const vector<unique_ptr<ExprAST>> &getArgs() const { return _args; }
+
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Call; }
+};
+
+//! SharedExprAST - A reference to a subexpression that occurs more than once in a hash-consed
+//! expression DAG. All references to the same cell generate its code only once and reuse the value,
+//! which is sound because the subexpression is pure and function bodies are straight-line code.
+class SharedExprAST : public ExprAST {
+public:
+    struct Cell {
+        unique_ptr<ExprAST> Expr;
+        Value *Generated = nullptr;
+    };
+
+    SharedExprAST(shared_ptr<Cell> C) : ExprAST(EK_Shared), _cell(move(C)) {}
+    Value *codegen() override;
+
+    const ExprAST &getExpr() const { return *_cell->Expr; }
+
+    static bool classof(const ExprAST *E) { return E->getKind() == EK_Shared; }
+
+private:
+    shared_ptr<Cell> _cell;
+};
+
+//! ValueType - The type of a value: a double, or a fixed-width vector of doubles that is lowered
+//! to an LLVM vector type. The enumerator is the number of lanes.
+enum class ValueType : unsigned {
+    Double = 1,
+    Vec2 = 2,
+    Vec4 = 4,
 };
 
 //! PrototypeAST - This class represents the "prototype" for a function,
 //! which captures its name, and its argument names (thus implicitly the number
-//! of arguments the function takes).
+//! of arguments the function takes), along with the argument types and the result type.
+//! Arguments are doubles unless annotated, as in "a:vec4"; the result type is inferred from the body.
 class PrototypeAST {
     string _name;
     vector<string> _args;
+    vector<ValueType> _types;
+    ValueType _returnType = ValueType::Double;
 
 public:
-    PrototypeAST(const string &name, vector<string> Args)
-            : _name(name), _args(move(Args)) {}
+    PrototypeAST(const string &name, vector<string> Args, vector<ValueType> Types = vector<ValueType>())
+            : _name(name), _args(move(Args)), _types(move(Types)) {
+        _types.resize(_args.size(), ValueType::Double);
+    }
     Function *codegen();
+    FunctionType *getFunctionType() const;
 
     const std::string &getName() const { return _name; }
+    const vector<string> &getArgs() const { return _args; }
+    const vector<ValueType> &getTypes() const { return _types; }
+    ValueType getReturnType() const { return _returnType; }
+    void setReturnType(ValueType Type) { _returnType = Type; }
+
+    //! isScalar - Whether all arguments and the result are doubles.
+    bool isScalar() const {
+        for (auto Type : _types) {
+            if (Type != ValueType::Double) {
+                return false;
+            }
+        }
+        return _returnType == ValueType::Double;
+    }
 };
 
 //! FunctionAST - This class represents a function definition itself.
+//! Definitions marked with "memo" are wrapped in a JIT-generated result cache.
+//! With tiered compilation, definitions are first compiled as lightly optimized tier 0 code.
 class FunctionAST {
     unique_ptr<PrototypeAST> _proto;
     unique_ptr<ExprAST> _body;
+    bool _memo;
 
 public:
-    FunctionAST(unique_ptr<PrototypeAST> Proto, unique_ptr<ExprAST> Body)
-            : _proto(move(Proto)), _body(move(Body)) {}
-    Function *codegen();
+    FunctionAST(unique_ptr<PrototypeAST> Proto, unique_ptr<ExprAST> Body, bool Memo = false)
+            : _proto(move(Proto)), _body(move(Body)), _memo(Memo) {}
+    Function *codegen(bool Tier0 = false);
+
+    //! codegenClone - Emit the body into a new, unoptimized function of the given name in the
+    //! current module, without registering it as the definition of this function.
+    Function *codegenClone(const string &Name, GlobalValue::LinkageTypes Linkage);
+
+    const PrototypeAST &getProto() const { return *_proto; }
+    const ExprAST &getBody() const { return *_body; }
+    bool isMemo() const { return _memo; }
 };
 
 #endif //CHICKADEE_AST_H_H
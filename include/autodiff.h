@@ -0,0 +1,39 @@
+//
+// Automatic differentiation of definitions, in forward and reverse mode.
+//
+
+#ifndef CHICKADEE_AUTODIFF_H
+#define CHICKADEE_AUTODIFF_H
+
+#include <string>
+#include <llvm/IR/IRBuilder.h>
+#include "ast.h"
+
+using namespace std;
+using namespace llvm;
+
+//! GradientSymbol - The array that gradient(...) stores the partial derivatives of a top-level expression to.
+const char *const GradientSymbol = "__anon_expr.gradient";
+
+//! isDiffBuiltin - Whether Name is one of the differentiation builtins, unless a user function of the same
+//! name shadows it:
+//!   grad(f, i, x1, ..., xn)   the partial derivative of f by its argument i at (x1, ..., xn), in reverse mode
+//!   deriv(f, i, x1, ..., xn)  the same, in forward mode
+//!   gradient(f, x1, ..., xn)  f at (x1, ..., xn), with all n partial derivatives stored to GradientSymbol;
+//!                             only allowed at the top level, where they are printed along with the value
+//! Arguments are counted from 0, and i wraps around the number of arguments. f must be a definition of
+//! doubles made of +, -, *, <, calls to other such definitions and the externs sin, cos, exp, log and sqrt.
+//! The derivative of < is taken to be 0, which is right everywhere except where its operands are equal.
+bool isDiffBuiltin(const string &Name);
+
+//! EmitDiffBuiltin - Emit the code for a call to a differentiation builtin. The derived functions are
+//! generated from the definitions' trees into the current module:
+//!   f.grad(x1, ..., xn, double *Adjoints)            returns f and stores all partial derivatives in one pass
+//!   f.fwd(x1, ..., xn, dx1, ..., dxn, double *Tangent)  returns f and stores its derivative along dx
+//! grad calls of the same function at structurally equal, pure arguments within a body share one f.grad call.
+Value *EmitDiffBuiltin(IRBuilder<> &Builder, const CallExprAST &Call);
+
+//! ResetDiffBuiltins - Forget the f.grad calls of the previous body; called before a body is generated.
+void ResetDiffBuiltins();
+
+#endif //CHICKADEE_AUTODIFF_H
@@ -17,16 +17,23 @@ using namespace llvm;
 
 //! TheContext is an opaque object that owns a lot of core LLVM data structures,
 //! such as the type and constant value tables.
-extern LLVMContext TheContext;
+extern thread_local LLVMContext TheContext;
 
 //! TheModule is an LLVM construct that contains functions and global variables. In many ways, it is the top-level
 //! structure that the LLVM IR uses to contain code.
 //! It will own the memory for all of the IR that we generate, which is why the codegen() method returns
 //! a raw Value*, rather than a unique_ptr<Value>.
-extern unique_ptr<Module> TheModule;
+extern thread_local unique_ptr<Module> TheModule;
 
-extern map<string, unique_ptr<PrototypeAST>> FunctionProtos;
+extern thread_local map<string, unique_ptr<PrototypeAST>> FunctionProtos;
+
+//! FunctionDefs - The source of the newest definition of every function that was added to the JIT.
+//! The definitions are kept exactly as parsed, so that they can be re-evaluated and specialized later.
+extern thread_local map<string, unique_ptr<FunctionAST>> FunctionDefs;
 
 Value *LogErrorV(const char *Str);
 
+//! getFunction - Find the named function in the current module, declaring it from its prototype if necessary.
+Function *getFunction(string Name);
+
 #endif //CHICKADEE_CODEGEN_H
@@ -0,0 +1,33 @@
+//
+// Dependency graph between definitions, driving incremental recompilation.
+//
+
+#ifndef CHICKADEE_DEPGRAPH_H
+#define CHICKADEE_DEPGRAPH_H
+
+#include <set>
+#include <string>
+
+using namespace std;
+
+//! UpdateDefinition - Record that the newest definition of Name, which must already be in FunctionDefs,
+//! was added to the JIT. If Name was defined before, every definition that transitively calls it is
+//! recompiled against the new code, so that nothing refers to the superseded code anymore and the
+//! garbage collector can reclaim it. Dependents that no longer compile (e.g. because the arity changed)
+//! are dropped.
+void UpdateDefinition(const string &Name);
+
+//! GetDependents - The definitions that transitively call Name.
+set<string> GetDependents(const string &Name);
+
+//! RestoreDefinitions - Record definitions whose code was linked into the JIT as ready-made objects,
+//! e.g. from the shared prelude. The definitions must already be in FunctionDefs. Nothing is recompiled.
+void RestoreDefinitions(const set<string> &Names);
+
+//! ResetDependencyGraph - Forget all definitions, when the session goes away.
+void ResetDependencyGraph();
+
+//! PrintDependencies - Print the callees and callers of every definition.
+void PrintDependencies();
+
+#endif //CHICKADEE_DEPGRAPH_H
@@ -0,0 +1,23 @@
+//
+// Reclaiming the JIT code and runtime data of superseded definitions.
+//
+
+#ifndef CHICKADEE_GC_H
+#define CHICKADEE_GC_H
+
+using namespace std;
+
+//! CollectGarbage - Remove the modules from the JIT that cannot be reached from the current definitions,
+//! such as superseded definitions and the specializations and optimized code only they used, and free the
+//! memo caches and tier slots that no remaining module refers to. Must only run between top-level items, while no JIT'd
+//! code of the session is running.
+void CollectGarbage();
+
+//! ResetGarbageStats - Forget the collection statistics, when the session goes away.
+void ResetGarbageStats();
+
+//! PrintMemoryStats - Print the live modules, memo caches and tier slots of the session, the memory they
+//! take, and what the collector reclaimed so far.
+void PrintMemoryStats();
+
+#endif //CHICKADEE_GC_H
@@ -0,0 +1,30 @@
+//
+// Hash-consing of expression trees into DAGs, and the code size statistics to measure it.
+//
+
+#ifndef CHICKADEE_HASHCONS_H
+#define CHICKADEE_HASHCONS_H
+
+#include <cstddef>
+#include "ast.h"
+
+using namespace std;
+
+//! HashConsEnabled - Whether function bodies are hash-consed before code generation, so that repeated
+//! pure subexpressions are emitted only once. Set by the --hash-cons command line flag.
+extern bool HashConsEnabled;
+
+//! HashCons - Build a copy of E in which every pure binary operator or call that occurs more than once
+//! is replaced by SharedExprAST references to a single node. Calls to functions that are not known to
+//! be pure are never shared, since each of them has to be executed.
+unique_ptr<ExprAST> HashCons(const ExprAST &E);
+
+//! RecordCodegen - Account for a function that was generated and optimized in the given time, with
+//! the given number of IR instructions before and after optimization.
+void RecordCodegen(double GenerateSeconds, double OptimizeSeconds, size_t Emitted, size_t Optimized);
+
+//! PrintCodegenStats - Print the amount of IR that was generated, the time it took, and what
+//! hash-consing saved.
+void PrintCodegenStats();
+
+#endif //CHICKADEE_HASHCONS_H
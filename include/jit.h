@@ -6,6 +6,7 @@
 #define CHICKADEE_JIT_H
 
 #include <memory>
+#include <mutex>
 #include <llvm/IR/LegacyPassManager.h>
 #include "KaleidoscopeJIT.h"
 #include "ast.h"
@@ -14,7 +15,13 @@ using namespace std;
 using namespace llvm;
 using namespace llvm::orc;
 
-extern unique_ptr<KaleidoscopeJIT> TheJIT;
-extern unique_ptr<legacy::FunctionPassManager> TheFPM;
+//! TheJIT/TheFPM - The JIT and the function pass manager of the session running on the current thread.
+extern thread_local unique_ptr<KaleidoscopeJIT> TheJIT;
+extern thread_local unique_ptr<legacy::FunctionPassManager> TheFPM;
+
+//! CompileMutex - Guards the LLVM context, the current module and the JIT against the background
+//! compiler. Held while generating or linking code, but not while running JIT'd code.
+//! Every session thread has a mutex of its own, since sessions share no compiler state.
+extern thread_local recursive_mutex CompileMutex;
 
 #endif //CHICKADEE_JIT_H
@@ -0,0 +1,22 @@
+//
+// Registration of JIT'd code with profilers and debuggers.
+//
+
+#ifndef CHICKADEE_JITEVENTS_H
+#define CHICKADEE_JITEVENTS_H
+
+#include "KaleidoscopeJIT.h"
+
+using namespace std;
+using namespace llvm;
+
+//! JITEventsEnabled - Whether every object the JIT links is announced to LLVM's JIT event listeners
+//! (the GDB JIT interface, plus Intel VTune and OProfile where LLVM was built with them), and its
+//! functions are written to /tmp/perf-<pid>.map for perf. Set by the --jit-events command line flag.
+extern bool JITEventsEnabled;
+
+//! GetJITEventObserver - The process-wide observer that every session's JIT reports to, or null
+//! if JIT events are disabled.
+orc::JITObjectObserver *GetJITEventObserver();
+
+#endif //CHICKADEE_JITEVENTS_H
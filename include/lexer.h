@@ -5,7 +5,10 @@
 #ifndef CHICKADEE_LEXER_H
 #define CHICKADEE_LEXER_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -23,15 +26,62 @@ enum class Token : int {
     Number = -5,
 };
 
-extern string IdentifierStr; // Filled in if Identifier
-extern double NumVal;        // Filled in if Number
+//! TokenBuffer - The tokens of the input read so far, stored as a structure of arrays: the kind of
+//! every token, its span in the source text and, for numbers, its value. The input is lexed in
+//! chunks in one pass each, and the parser consumes the tokens by index.
+struct TokenBuffer {
+    //! The source text the spans point into; text before the first token has been dropped.
+    string Source;
+    //! The absolute input offset of Source[0].
+    uint64_t SourceBase = 0;
 
-int getToken();
+    vector<int> Kinds;
+    vector<uint32_t> Offsets;
+    vector<uint32_t> Lengths;
+    vector<double> Numbers;
+
+    //! The absolute input offsets at which lines start, and the number of lines that were dropped
+    //! in front of them.
+    vector<uint64_t> LineStarts = vector<uint64_t>(1, 0);
+    unsigned LinesDropped = 0;
+
+    //! tokenize - Lex Source from offset From to the end, appending the tokens.
+    void tokenize(size_t From);
+
+    //! compact - Drop the tokens in front of Keep and the source text they span.
+    void compact(size_t Keep);
+
+    void clear();
+};
+
+//! SourceLocation - A 1-based line and column in the input.
+struct SourceLocation {
+    unsigned Line;
+    unsigned Column;
+};
 
 //! CurTok/getNextToken - Provide a simple token buffer.  CurTok is the current
-//! token the parser is looking at.  getNextToken reads another token from the
-//! lexer and updates CurTok with its results.
-extern int CurTok;
+//! token the parser is looking at.  getNextToken advances to the next token in
+//! the token buffer, lexing more input if needed, and updates CurTok with its kind.
+extern thread_local int CurTok;
 int getNextToken();
 
+//! getTokenText/getTokenNumber - The spelling and the numeric value of the current token.
+string getTokenText();
+double getTokenNumber();
+
+//! getTokenLocation - Where the current token starts in the input.
+SourceLocation getTokenLocation();
+
+//! peekToken - The kind of the token N positions after the current one, without consuming anything.
+//! Lexes more input if needed, so it may block on interactive input.
+int peekToken(unsigned N = 1);
+
+//! compactTokens - Release the tokens that have been consumed. Must only be called between top-level
+//! items, when the parser looks at nothing before the current token.
+void compactTokens();
+
+//! ResetLexer - Drop all buffered input, e.g. before switching to another input stream.
+void ResetLexer();
+
 #endif //CHICKADEE_LEXER_H
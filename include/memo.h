@@ -0,0 +1,92 @@
+//
+// Memoization of pure definitions through JIT-generated result caches.
+//
+
+#ifndef CHICKADEE_MEMO_H
+#define CHICKADEE_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <llvm/IR/Function.h>
+
+using namespace std;
+using namespace llvm;
+
+//! MemoCacheEntries - Number of slots in every memoization cache; must be a power of two.
+const uint64_t MemoCacheEntries = 4096;
+
+//! MemoCache - A bounded, direct-mapped result cache for one memoized definition.
+//! The JIT'd wrapper reads and writes the cache words directly: three statistics counters,
+//! followed by MemoCacheEntries slots of (sequence, argument bits..., result bits).
+//! A slot's sequence word is 0 while empty, odd while being written and even otherwise,
+//! which lets readers detect torn entries and makes the cache safe to share between threads.
+class MemoCache {
+public:
+    enum : uint64_t {
+        HitsWord = 0,
+        MissesWord = 1,
+        EvictionsWord = 2,
+        HeaderWords = 3,
+    };
+
+    MemoCache(const string &Function, const string &Symbol, unsigned Arity);
+
+    const string &getFunction() const { return _function; }
+    const string &getSymbol() const { return _symbol; }
+    unsigned getArity() const { return _arity; }
+    uint64_t getSlotWords() const { return _arity + 2; }
+    uint64_t getBytes() const { return (HeaderWords + MemoCacheEntries * getSlotWords()) * sizeof(uint64_t); }
+    uint64_t *getWords() { return _words.get(); }
+
+    uint64_t getCounter(uint64_t Word) const;
+    uint64_t countUsedSlots() const;
+
+private:
+    string _function;
+    string _symbol;
+    unsigned _arity;
+    unique_ptr<uint64_t[]> _words;
+};
+
+//! EmitMemoWrapper - Generate the body of F as a cache lookup that falls back to calling Body,
+//! which must have the same signature as F. The cache is registered with the JIT under a fresh
+//! symbol, so that redefinitions start out with an empty cache.
+void EmitMemoWrapper(Function *F, Function *Body);
+
+//! GetMemoCache - The cache of the newest definition of a memoized function, or null if there is none.
+MemoCache *GetMemoCache(const string &Function);
+
+//! SetCurrentMemoCache - Make Cache the current cache of Function again, or forget the current cache if it is
+//! null, when the code that was generated with a newer one is thrown away. Caches that are no longer current
+//! are freed by CollectMemoCaches once no code refers to them.
+void SetCurrentMemoCache(const string &Function, MemoCache *Cache);
+
+//! AdoptMemoCache - Make a cache that is owned elsewhere, such as one of the shared prelude, the current
+//! cache of its function and register it with the JIT. The cache is safe to share between sessions.
+void AdoptMemoCache(MemoCache &Cache);
+
+//! GetMemoCaches - Every cache the current session uses, including adopted ones and those of superseded
+//! definitions.
+vector<MemoCache *> GetMemoCaches();
+
+//! RestoreMemoCache - Recreate a cache saved in a snapshot under its old symbol, with all words zeroed, and
+//! register it with the JIT before the code that uses it is linked. Current caches are the ones of the newest definitions.
+MemoCache &RestoreMemoCache(const string &Function, const string &Symbol, unsigned Arity, bool Current);
+
+//! CollectMemoCaches - Free the caches of superseded definitions that no code linked into the JIT refers
+//! to anymore. Returns the number of caches freed and adds the bytes they took to Bytes.
+unsigned CollectMemoCaches(uint64_t &Bytes);
+
+//! GetMemoCacheUsage - The number of caches the session owns and the bytes they take.
+void GetMemoCacheUsage(size_t &Caches, uint64_t &Bytes);
+
+//! ResetMemoCaches - Drop the caches of all memoized functions, when the session goes away.
+void ResetMemoCaches();
+
+//! PrintMemoStats - Print hit rate statistics for the current cache of every memoized definition.
+void PrintMemoStats();
+
+#endif //CHICKADEE_MEMO_H
@@ -0,0 +1,33 @@
+//
+// Parallel map/reduce builtins.
+//
+
+#ifndef CHICKADEE_PARALLEL_H
+#define CHICKADEE_PARALLEL_H
+
+#include <string>
+#include <llvm/IR/IRBuilder.h>
+#include "ast.h"
+
+using namespace std;
+using namespace llvm;
+
+//! isParallelBuiltin - Whether Name is one of the parallel builtins, unless a user function of the same name
+//! shadows it:
+//!   parsum(f, lo, hi)     sums f(i) for all integers lo <= i < hi
+//!   parmap(f, g, lo, hi)  maps f over lo <= i < hi and reduces the results with g, which must be associative
+//! Their leading arguments name definitions rather than being expressions. Bounds beyond +-2^53 are clamped
+//! to it, and a NaN bound makes the range empty.
+bool isParallelBuiltin(const string &Name);
+
+//! getFunctionArgumentCount - How many leading arguments of a parallel builtin name functions.
+unsigned getFunctionArgumentCount(const string &Builtin);
+
+//! DeclareParallelRuntime - Register the runtime functions that the code of the parallel builtins calls
+//! with the JIT, for code that is linked without being generated, such as the objects of a snapshot.
+void DeclareParallelRuntime();
+
+//! EmitParallelBuiltin - Emit a call to the runtime that runs a parallel builtin on the thread pool.
+Value *EmitParallelBuiltin(IRBuilder<> &Builder, const CallExprAST &Call);
+
+#endif //CHICKADEE_PARALLEL_H
@@ -11,10 +11,11 @@
 
 /// BinOpPrecedence - This holds the precedence for each binary operator that is
 /// defined.
-extern map<char, int> BinOpPrecedence;
+extern thread_local map<char, int> BinOpPrecedence;
 int GetTokPrecedence();
 
 unique_ptr<ExprAST> LogError(const char *Str);
+unique_ptr<ExprAST> LogParseError(const char *Str);
 unique_ptr<PrototypeAST> LogErrorP(const char *Str);
 unique_ptr<ExprAST> ParseNumberExpr();
 unique_ptr<ExprAST> ParseParenExpr();
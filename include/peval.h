@@ -0,0 +1,54 @@
+//
+// AST-level partial evaluation ahead of code generation.
+//
+
+#ifndef CHICKADEE_PEVAL_H
+#define CHICKADEE_PEVAL_H
+
+#include <memory>
+#include <set>
+#include <string>
+#include "ast.h"
+
+using namespace std;
+
+//! PartialEvalEnabled - Whether definitions and top-level expressions are partially evaluated
+//! before code generation. Cleared by the --no-peval command line flag.
+extern bool PartialEvalEnabled;
+
+//! MaxSpecializationDepth - How deep specializations may nest when a specialized body in turn
+//! calls functions with constant arguments.
+const unsigned MaxSpecializationDepth = 4;
+
+//! PartiallyEvaluate - Return a simplified copy of the expression E.
+//! Operators with constant operands are folded, calls to already compiled pure definitions whose
+//! arguments are all constant are evaluated in the JIT and replaced by their result, and calls with
+//! some constant arguments are redirected to a cached clone of the callee specialized on them.
+//! Functions in Stale are about to be recompiled, so their current code is never called.
+unique_ptr<ExprAST> PartiallyEvaluate(const ExprAST &E, const set<string> &Stale);
+
+//! PartiallyEvaluate - Return a copy of a definition whose body has been partially evaluated,
+//! or null if partial evaluation is disabled. The original definition is left untouched, so that
+//! it can be evaluated again once the functions it calls have changed.
+unique_ptr<FunctionAST> PartiallyEvaluate(const FunctionAST &FnAST, const set<string> &Stale = set<string>());
+
+//! GetSpecializationCount/ReserveSpecializations - The number of specialized clones created so far,
+//! process-wide, and a way to make sure that clones created from now on are numbered above Count,
+//! e.g. because clones numbered up to Count were restored from a snapshot.
+unsigned GetSpecializationCount();
+void ReserveSpecializations(unsigned Count);
+
+//! InvalidateSpecializations - Forget the cached specializations of Name and of the definitions that call
+//! it, because Name is being redefined and they may have folded or specialized calls to it.
+void InvalidateSpecializations(const string &Name);
+
+//! CollectSpecializations - Forget the cached specializations whose clones the collector has removed.
+void CollectSpecializations();
+
+//! ResetPartialEvaluation - Forget all specializations and statistics, when the session goes away.
+void ResetPartialEvaluation();
+
+//! PrintPartialEvalStats - Print how much was folded and specialized, and what it cost and saved.
+void PrintPartialEvalStats();
+
+#endif //CHICKADEE_PEVAL_H
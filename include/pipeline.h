@@ -0,0 +1,18 @@
+//
+// A pipelined main loop that parses ahead while earlier items are compiled and run.
+//
+
+#ifndef CHICKADEE_PIPELINE_H
+#define CHICKADEE_PIPELINE_H
+
+//! PipelineEnabled - Whether the input is parsed on a separate thread, ahead of the items that are
+//! being compiled and run. Meant for scripts: commands only run once the token after them has been
+//! read. Set by the --pipeline command line flag.
+extern bool PipelineEnabled;
+
+//! PipelinedMainLoop - Like MainLoop, but a producer thread lexes and parses the input of the current
+//! session into a bounded queue, while the current thread compiles and runs the items in order.
+//! Nothing may have been read from the input yet.
+void PipelinedMainLoop();
+
+#endif //CHICKADEE_PIPELINE_H
@@ -0,0 +1,23 @@
+//
+// A prelude of definitions that is compiled once and shared by every session.
+//
+
+#ifndef CHICKADEE_PRELUDE_H
+#define CHICKADEE_PRELUDE_H
+
+#include <string>
+
+using namespace std;
+
+//! LoadPrelude - Run the given file in the current session, keeping the object code of its definitions
+//! so that other sessions can link it instead of compiling the definitions again. Tiered compilation is
+//! off for the prelude, so that its code does not depend on the tier slots of this session.
+//! Returns false if the file cannot be read.
+bool LoadPrelude(const string &Path);
+
+//! RestorePrelude - Make the prelude's definitions available in the current, freshly initialized session.
+//! The definitions are parsed again for the compiler's bookkeeping, but their code is linked from the
+//! objects kept by LoadPrelude. Memoized prelude functions share their cache across all sessions.
+void RestorePrelude();
+
+#endif //CHICKADEE_PRELUDE_H
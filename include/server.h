@@ -0,0 +1,18 @@
+//
+// Multi-session evaluation server on a local Unix domain socket.
+//
+
+#ifndef CHICKADEE_SERVER_H
+#define CHICKADEE_SERVER_H
+
+#include <string>
+
+using namespace std;
+
+//! RunServer - Serve REPL sessions on the Unix domain socket at Path until the process is terminated.
+//! Every connection is a session of its own, with its own JIT, definitions and statistics, that speaks
+//! the same protocol as the interactive REPL. Up to Threads sessions run at the same time; further
+//! connections wait for a free session thread. Returns only on error.
+int RunServer(const string &Path, unsigned Threads);
+
+#endif //CHICKADEE_SERVER_H
@@ -0,0 +1,33 @@
+//
+// REPL sessions: the streams a session talks through and the lifetime of its compiler state.
+//
+
+#ifndef CHICKADEE_SESSION_H
+#define CHICKADEE_SESSION_H
+
+#include <cstdio>
+#include <llvm/IR/Value.h>
+
+using namespace llvm;
+
+//! ReplIn/ReplOut - The streams the REPL on the current thread reads its input from and writes prompts,
+//! results and errors to. They are stdin and stderr, unless the thread serves a client of the server.
+extern thread_local FILE *ReplIn;
+extern thread_local FILE *ReplOut;
+
+//! PrintIR - Print the IR of a value to ReplOut, like Value::dump() does for stderr.
+void PrintIR(const Value &V);
+
+//! InitializeSession - Set up the compiler state of the current thread: the standard binary operators,
+//! the JIT and the first module.
+void InitializeSession();
+
+//! ClearSession - Tear down all compiler state of the current thread like ResetSession, but leave its input
+//! alone, so that the session can carry on reading from where it is, e.g. after loading a snapshot.
+void ClearSession();
+
+//! ResetSession - Tear down all compiler state of the current thread, so that it can host a new session.
+//! No JIT'd code of the old session may be running anymore.
+void ResetSession();
+
+#endif //CHICKADEE_SESSION_H
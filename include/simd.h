@@ -0,0 +1,45 @@
+//
+// Fixed-width vectors of doubles, lowered to LLVM vector types.
+//
+
+#ifndef CHICKADEE_SIMD_H
+#define CHICKADEE_SIMD_H
+
+#include <string>
+#include <llvm/IR/IRBuilder.h>
+#include "ast.h"
+
+using namespace std;
+using namespace llvm;
+
+//! ParseValueType - The type named by a parameter annotation: "double", "vec2" or "vec4".
+bool ParseValueType(const string &Name, ValueType &VT);
+
+//! getLLVMType - The LLVM type that values of the given type are lowered to: double, <2 x double>
+//! or <4 x double>, so that the backend can use packed SSE and AVX instructions.
+Type *getLLVMType(ValueType VT);
+
+//! getLaneCount - The number of doubles in a value of LLVM type T, as generated by codegen.
+unsigned getLaneCount(Type *T);
+
+//! InferType - The type of E in the body of P. Calls take the result type of their callee's prototype.
+ValueType InferType(const ExprAST &E, const PrototypeAST &P);
+
+//! isVectorBuiltin - Whether Name is one of the vector builtins, unless a user function of the same
+//! name shadows it:
+//!   vec2(a, b), vec4(a, b, c, d)  build a vector from its lanes; a single argument is splatted
+//!   lane(v, i)                     lane i of v, counted from 0; i wraps around the vector width
+//!   hsum(v), hmin(v), hmax(v)      the sum, the minimum and the maximum of the lanes of v
+bool isVectorBuiltin(const string &Name);
+
+//! EmitVectorBuiltin - Emit the code for a call to a vector builtin.
+Value *EmitVectorBuiltin(IRBuilder<> &Builder, const CallExprAST &Call);
+
+//! EmitSplat - Broadcast Scalar to every lane of a vector of the same width as Vector.
+Value *EmitSplat(IRBuilder<> &Builder, Value *Scalar, Value *Vector);
+
+//! EmitLaneStore - Emit a function Name(double *Out) next to F, which must take no arguments and
+//! return a vector, that calls F and stores the lanes of its result to Out.
+Function *EmitLaneStore(Function *F, const string &Name);
+
+#endif //CHICKADEE_SIMD_H
@@ -0,0 +1,43 @@
+//
+// Saving a session to a file and restoring it without parsing or compiling anything.
+//
+
+#ifndef CHICKADEE_SNAPSHOT_H
+#define CHICKADEE_SNAPSHOT_H
+
+#include <string>
+
+using namespace std;
+
+//! SnapshotPath - The file that the :save command writes and the :load command reads. Set by the
+//! --snapshot=<path> command line flag, which also restores new sessions from the file.
+extern string SnapshotPath;
+
+//! SnapshotRestoreEnabled - Whether every new session, including each session of the server, starts out
+//! restored from SnapshotPath when the file exists. Set by --snapshot=<path>.
+extern bool SnapshotRestoreEnabled;
+
+//! SaveSnapshot - Write the current session to Path: the operator precedences, prototypes and definitions,
+//! the memo caches and tier slots its code refers to, and the object code of every module in its JIT.
+//! Returns false if the file cannot be written.
+bool SaveSnapshot(const string &Path);
+
+//! LoadSnapshot - Replace the current session with the one saved in Path. The object code is linked straight
+//! out of the memory mapped file and the definitions are read back as trees, so the front end and the code
+//! generator are not involved. Returns false, leaving the session as it was, if the file cannot be read, is
+//! not a snapshot, or was written for a different target or for CPU features that this host lacks.
+bool LoadSnapshot(const string &Path);
+
+//! ResetSnapshots - Release the files that the current session was restored from, once its JIT is gone.
+void ResetSnapshots();
+
+//! SaveSessionSnapshot/LoadSessionSnapshot - The :save and :load commands, on SnapshotPath.
+void SaveSessionSnapshot();
+void LoadSessionSnapshot();
+
+//! RestoreSessionSnapshot - Restore a freshly initialized session from SnapshotPath, if
+//! SnapshotRestoreEnabled and the file exists. Without a snapshot yet, the session stays as it is and :save
+//! creates one.
+void RestoreSessionSnapshot();
+
+#endif //CHICKADEE_SNAPSHOT_H
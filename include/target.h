@@ -0,0 +1,56 @@
+//
+// The CPU that generated code is compiled for, and the variants of hot functions for other CPUs.
+//
+
+#ifndef CHICKADEE_TARGET_H
+#define CHICKADEE_TARGET_H
+
+#include <string>
+#include <vector>
+#include <llvm/MC/MCSubtargetInfo.h>
+
+using namespace std;
+
+//! TargetCPU/TargetFeatures - Overrides for the CPU and the features that code is generated for, set by the
+//! --cpu=<name> and --features=<+feature,-feature,...> command line flags. Without --cpu, code is compiled
+//! for the host CPU and every feature the host has; with it, for the features that CPU has by default, which
+//! makes code that is saved in snapshots portable to other machines. --features is applied last either way.
+extern string TargetCPU;
+extern string TargetFeatures;
+
+//! MultiversionEnabled - Whether the optimized code of hot functions is also compiled for the CPUs listed by
+//! GetCodeVariants, and the best variant the running host supports is picked whenever the code is linked,
+//! including when it is restored from a snapshot on another machine. Set by the --multiversion flag;
+//! useful together with a --cpu that is older than the machines the code runs on.
+extern bool MultiversionEnabled;
+
+//! GetTargetCPU/GetTargetAttributes - The CPU name and the feature list ("+avx2", "-avx512f", ...) that the
+//! JIT of every session generates code for.
+string GetTargetCPU();
+vector<string> GetTargetAttributes();
+
+//! GetEnabledFeatures - The features that code generated for a subtarget relies on, as a "+feature" list for
+//! HostSupports: every feature the host knows by name that the subtarget's CPU or feature string turns on,
+//! and the ones --features enables, known or not.
+string GetEnabledFeatures(const llvm::MCSubtargetInfo &Subtarget);
+
+//! CodeVariant - A CPU that hot functions are multiversioned for, named by the suffix its variants get.
+//! Features lists what the host must support to run them.
+struct CodeVariant {
+    const char *Name;
+    const char *CPU;
+    const char *Features;
+};
+
+//! GetCodeVariants - The variants for the host's architecture, best first; none if it has no variants.
+const vector<CodeVariant> &GetCodeVariants();
+
+//! HostSupports - Whether the host has every feature that a comma separated list enables with '+'.
+//! Missing is set to the first one that it lacks.
+bool HostSupports(const string &Features, string &Missing);
+
+//! PrintTargetInfo - Print the CPU and features that code is generated for, and the variants of hot
+//! functions that this host can run.
+void PrintTargetInfo();
+
+#endif //CHICKADEE_TARGET_H
@@ -0,0 +1,83 @@
+//
+// A work-stealing thread pool for the parallel builtins.
+//
+
+#ifndef CHICKADEE_THREADPOOL_H
+#define CHICKADEE_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//! WorkStealingPool - Runs index range chunks on a fixed set of worker threads. Every worker owns a
+//! deque of chunks: it takes work from the back of its own deque and steals from the front of the
+//! others' when it runs dry. Threads that are not workers, such as the REPL thread, share one extra
+//! deque and help out with any queued work while they wait for their own job to finish, which also
+//! makes nested parallel calls safe.
+class WorkStealingPool {
+public:
+    //! The work for one chunk [Begin, End) of an index range, returning the chunk's partial result.
+    typedef function<double(int64_t Begin, int64_t End)> ChunkFn;
+    //! Combines two partial results; must be associative.
+    typedef function<double(double, double)> CombineFn;
+
+    explicit WorkStealingPool(unsigned Parallelism);
+    ~WorkStealingPool();
+
+    //! getParallelism - The number of threads that work on a job, including the calling thread.
+    unsigned getParallelism() const { return static_cast<unsigned>(Workers.size()) + 1; }
+
+    //! parallelReduce - Run Chunk over [Lo, Hi) split into chunks and combine the partial results
+    //! in index order, so that the result does not depend on how the chunks were scheduled.
+    double parallelReduce(int64_t Lo, int64_t Hi, const ChunkFn &Chunk, const CombineFn &Combine);
+
+private:
+    struct Job {
+        const ChunkFn *Chunk;
+        vector<double> Results;
+        atomic<size_t> Remaining;
+    };
+
+    struct Task {
+        Job *Owner;
+        int64_t Begin;
+        int64_t End;
+        size_t Index;
+    };
+
+    struct TaskQueue {
+        mutex Mutex;
+        deque<Task> Tasks;
+    };
+
+    void runWorker(unsigned Index);
+    bool popTask(unsigned Index, Task &Result);
+    bool stealTask(unsigned Index, Task &Result);
+    bool findTask(unsigned Index, Task &Result);
+    void runTask(const Task &T);
+    unsigned currentQueue() const;
+
+    vector<thread> Workers;
+    vector<unique_ptr<TaskQueue>> Queues;
+    atomic<size_t> QueuedTasks;
+    mutex SleepMutex;
+    condition_variable SleepCondition;
+    bool Stopping;
+};
+
+//! ParallelThreads - The parallelism of the pool, or 0 to size it to the machine.
+//! Set by the --threads command line flag.
+extern unsigned ParallelThreads;
+
+//! GetThreadPool - The process-wide pool, created on first use.
+WorkStealingPool &GetThreadPool();
+
+#endif //CHICKADEE_THREADPOOL_H
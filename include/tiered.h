@@ -0,0 +1,132 @@
+//
+// Profile-guided tiered recompilation of hot definitions.
+//
+
+#ifndef CHICKADEE_TIERED_H
+#define CHICKADEE_TIERED_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <llvm/IR/IRBuilder.h>
+
+using namespace std;
+using namespace llvm;
+
+//! TieredCompilationEnabled - Whether definitions start out as lightly optimized tier 0 code that is
+//! recompiled in the background once it gets hot. Set by the --tiered command line flag.
+extern bool TieredCompilationEnabled;
+
+//! TierUpThreshold - The number of calls after which a tier 0 function is recompiled.
+extern uint64_t TierUpThreshold;
+
+struct TierSlot;
+
+//! TierSlotData - The part of a tier slot that JIT'd code accesses: the current call target
+//! and the number of calls counted by the tier 0 code.
+struct TierSlotData {
+    void *Target;
+    uint64_t Calls;
+    TierSlot *Slot;
+};
+
+//! TierSlot - The indirection through which every call to one definition of a tiered function
+//! goes. Swapping the target atomically redirects all callers to the recompiled code.
+struct TierSlot {
+    enum State {
+        Baseline,
+        Queued,
+        Optimized,
+    };
+
+    TierSlotData Data;
+    string Function;
+    string Symbol;
+    unsigned Generation;
+    atomic<int> Tier;
+    //! The function of the optimized code the slot points at, once it is optimized.
+    string OptimizedSymbol;
+    //! The thread that compiles and runs this definition; tier-ups triggered on other threads
+    //! are deferred to the next safe point of this thread.
+    thread::id Owner;
+    //! The number of jobs of the background compiler that point at the slot. Guarded by the
+    //! CompileMutex of the owning session.
+    unsigned Jobs = 0;
+};
+
+//! CallRedirects - Calls to these functions are emitted as direct calls to the named function in
+//! the current module instead, e.g. to the local copy of a hot callee that is meant to be inlined.
+extern thread_local map<string, string> CallRedirects;
+
+//! CreateTierSlot - Create the slot for a new definition of Function that is about to be compiled.
+//! The slot stays pending until the definition has been added to the JIT.
+TierSlot *CreateTierSlot(const string &Function);
+
+//! SkipTierSlot - Record that a new definition of Function is about to be compiled without a slot, e.g.
+//! because it is memoized, so that new callers call it directly instead of through the slot of the
+//! definition it replaces.
+void SkipTierSlot(const string &Function);
+
+//! PublishTierSlot - Point the pending slot of Function at its freshly added tier 0 code and make
+//! it the slot that new callers use. Without a pending slot, Function has no slot from now on.
+void PublishTierSlot(const string &Function);
+
+//! DiscardTierSlot - Drop the pending slot of Function, or the record that it skips one, e.g. because its
+//! code generation failed.
+void DiscardTierSlot(const string &Function);
+
+//! FindTierSlot - The slot that calls to Function should go through, or null if it is not tiered.
+TierSlot *FindTierSlot(const string &Function);
+
+//! GetTierSlots - Every slot of the current session, including those of superseded definitions.
+vector<const TierSlot *> GetTierSlots();
+
+//! RestoreTierSlot - Recreate a slot saved in a snapshot under its old symbol, before the code that calls
+//! through it is linked. Optimized names the optimized code it pointed at, or is empty if it was not
+//! optimized. Current slots are the ones new callers use.
+void RestoreTierSlot(const string &Function, const string &Symbol, unsigned Generation, const string &Optimized,
+                     bool Current);
+
+//! PublishRestoredTierSlots - Point the restored slots at their code, once all of it is linked.
+void PublishRestoredTierSlots();
+
+//! EmitTierUpCheck - Emit the call counting prologue of tier 0 function F into a new entry block,
+//! and return the block that the body should be generated into.
+BasicBlock *EmitTierUpCheck(Function *F, TierSlot &Slot);
+
+//! EmitTier0Alias - Link the tier 0 code F of a slot's definition under a name of its own as well, which
+//! the slot refers to once it is published, so that the collector keeps exactly that code alive.
+void EmitTier0Alias(Function *F, TierSlot &Slot);
+
+//! EmitSlotTarget - Emit a load of the current call target of a tier slot, as an i8*.
+Value *EmitSlotTarget(IRBuilder<> &Builder, TierSlot &Slot);
+
+//! EmitSlotCall - Emit an indirect call to Callee through its tier slot.
+Value *EmitSlotCall(IRBuilder<> &Builder, TierSlot &Slot, Function *Callee, ArrayRef<Value *> Args);
+
+//! ProcessPendingTierUps - Recompile the functions of the current thread's session that got hot on
+//! other threads. Must be called at a safe point, i.e. when no code is being generated.
+void ProcessPendingTierUps();
+
+//! CollectTierSlots - Free the slots of superseded definitions that no code linked into the JIT refers to
+//! and that no tier-up or job of the background compiler points at anymore. Returns the number of slots
+//! freed and adds the bytes they took to Bytes.
+unsigned CollectTierSlots(uint64_t &Bytes);
+
+//! GetTierSlotUsage - The number of slots the session owns and the bytes they take.
+void GetTierSlotUsage(size_t &Slots, uint64_t &Bytes);
+
+//! ShutdownTieredCompilation - Stop the background compiler, dropping unfinished work.
+void ShutdownTieredCompilation();
+
+//! ResetTieredCompilation - Drop all tier slots of the current session, along with the tier-ups that are
+//! still pending or queued for it. JIT'd code of the session must not run anymore.
+void ResetTieredCompilation();
+
+//! PrintTierStats - Print the call counts and tiers of all tiered functions.
+void PrintTierStats();
+
+#endif //CHICKADEE_TIERED_H
@@ -5,6 +5,21 @@
 #ifndef CHICKADEE_TOPLEVEL_H
 #define CHICKADEE_TOPLEVEL_H
 
+#include <memory>
+#include <string>
+#include "ast.h"
+
+using namespace std;
+
+//! CompileDefinition/CompileExtern/EvaluateTopLevelExpression - Compile a parsed top-level item into
+//! the current session, and run it if it is an expression.
+void CompileDefinition(unique_ptr<FunctionAST> FnAST);
+void CompileExtern(unique_ptr<PrototypeAST> ProtoAST);
+void EvaluateTopLevelExpression(unique_ptr<FunctionAST> FnAST);
+
+//! RunCommand - Run the REPL command ':Name'.
+void RunCommand(const string &Name);
+
 void MainLoop();
 
 #endif //CHICKADEE_TOPLEVEL_H
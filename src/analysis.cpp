@@ -0,0 +1,56 @@
+//
+// Call graph and purity analysis over the expression tree.
+//
+
+#include "analysis.h"
+#include "parallel.h"
+#include "autodiff.h"
+#include "simd.h"
+
+thread_local set<string> PureFunctions;
+
+void collectCallees(const ExprAST &E, set<string> &Callees) {
+    if (auto *S = dyn_cast<SharedExprAST>(&E)) {
+        collectCallees(S->getExpr(), Callees);
+        return;
+    }
+
+    if (auto *B = dyn_cast<BinaryExprAST>(&E)) {
+        collectCallees(B->getLHS(), Callees);
+        collectCallees(B->getRHS(), Callees);
+        return;
+    }
+
+    if (auto *C = dyn_cast<CallExprAST>(&E)) {
+        auto &Args = C->getArgs();
+        size_t FirstExpression = 0;
+
+        // The parallel and differentiation builtins call the functions named by their leading arguments.
+        if (isParallelBuiltin(C->getCallee()) || isDiffBuiltin(C->getCallee())) {
+            FirstExpression = isDiffBuiltin(C->getCallee()) ? 1 : getFunctionArgumentCount(C->getCallee());
+            for (size_t i = 0; i != FirstExpression && i != Args.size(); ++i) {
+                if (auto *Ref = dyn_cast<VariableExprAST>(Args[i].get())) {
+                    Callees.insert(Ref->getName());
+                }
+            }
+        } else if (!isVectorBuiltin(C->getCallee())) {
+            Callees.insert(C->getCallee());
+        }
+
+        for (size_t i = FirstExpression; i < Args.size(); ++i) {
+            collectCallees(*Args[i], Callees);
+        }
+    }
+}
+
+bool isPureBody(const string &Name, const ExprAST &Body) {
+    set<string> Callees;
+    collectCallees(Body, Callees);
+
+    for (auto &Callee : Callees) {
+        if (Callee != Name && !PureFunctions.count(Callee)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,550 @@
+//
+// Automatic differentiation of definitions, in forward and reverse mode.
+//
+
+#include <cstring>
+#include <map>
+#include <set>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Verifier.h>
+
+#include "autodiff.h"
+#include "analysis.h"
+#include "codegen.h"
+#include "jit.h"
+#include "parallel.h"
+#include "simd.h"
+#include "session.h"
+
+//! DiffMode - Which of the two derived functions of a definition to emit.
+enum class DiffMode {
+    Forward,
+    Reverse,
+};
+
+bool isDiffBuiltin(const string &Name) {
+    return (Name == "grad" || Name == "deriv" || Name == "gradient") && !FunctionProtos.count(Name);
+}
+
+//! hasExternDerivative - Whether the extern Name is one of the math functions whose derivative is known.
+static bool hasExternDerivative(const string &Name) {
+    return Name == "sin" || Name == "cos" || Name == "exp" || Name == "log" || Name == "sqrt";
+}
+
+//! EmitExternDerivative - The derivative of the extern Name at X, given its value FX there.
+static Value *EmitExternDerivative(IRBuilder<> &B, const string &Name, Value *X, Value *FX) {
+    Module *M = B.GetInsertBlock()->getModule();
+    Type *DoubleTy = B.getDoubleTy();
+    if (Name == "sin") {
+        return B.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::cos, DoubleTy), X, "costmp");
+    }
+    if (Name == "cos") {
+        return B.CreateFNeg(B.CreateCall(Intrinsic::getDeclaration(M, Intrinsic::sin, DoubleTy), X), "negsintmp");
+    }
+    if (Name == "exp") {
+        return FX;
+    }
+    if (Name == "log") {
+        return B.CreateFDiv(ConstantFP::get(DoubleTy, 1.0), X, "invtmp");
+    }
+    return B.CreateFDiv(ConstantFP::get(DoubleTy, 0.5), FX, "invtmp");
+}
+
+//! isDifferentiable - Check that Name and everything it calls can be differentiated, reporting the first
+//! obstacle otherwise. Checking up front means that emitting the derived functions cannot fail halfway.
+static bool isDifferentiable(const string &Name, set<string> &Checked);
+
+static bool isDifferentiableExpr(const ExprAST &E, set<string> &Checked) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number:
+        case ExprAST::EK_Variable: {
+            return true;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            return isDifferentiableExpr(B.getLHS(), Checked) && isDifferentiableExpr(B.getRHS(), Checked);
+        }
+        case ExprAST::EK_Shared: {
+            return isDifferentiableExpr(cast<SharedExprAST>(E).getExpr(), Checked);
+        }
+        case ExprAST::EK_Call: {
+            break;
+        }
+    }
+
+    auto &C = cast<CallExprAST>(E);
+    auto &Callee = C.getCallee();
+    for (auto &Arg : C.getArgs()) {
+        if (!isDifferentiableExpr(*Arg, Checked)) {
+            return false;
+        }
+    }
+
+    if (isParallelBuiltin(Callee) || isDiffBuiltin(Callee) || isVectorBuiltin(Callee)) {
+        fprintf(ReplOut, "LogError: Cannot differentiate through the builtin '%s'\n", Callee.c_str());
+        return false;
+    }
+    if (FunctionDefs.count(Callee)) {
+        return isDifferentiable(Callee, Checked);
+    }
+    if (!hasExternDerivative(Callee) || C.getArgs().size() != 1) {
+        fprintf(ReplOut, "LogError: Cannot differentiate the extern '%s'\n", Callee.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool isDifferentiable(const string &Name, set<string> &Checked) {
+    if (!Checked.insert(Name).second) {
+        return true;
+    }
+
+    auto Def = FunctionDefs.find(Name);
+    if (Def == FunctionDefs.end() || !Def->second->getProto().isScalar()) {
+        fprintf(ReplOut, "LogError: Cannot differentiate '%s', which is not a definition of doubles\n",
+                Name.c_str());
+        return false;
+    }
+    return isDifferentiableExpr(Def->second->getBody(), Checked);
+}
+
+static Function *GetDerivedFunction(const string &Name, DiffMode Mode);
+
+//! CreateEntryAlloca - Room for Count doubles in the entry block of F.
+static Value *CreateEntryAlloca(Function *F, unsigned Count, const Twine &Name) {
+    IRBuilder<> Entry(&F->getEntryBlock(), F->getEntryBlock().begin());
+    return Entry.CreateAlloca(Entry.getDoubleTy(), Entry.getInt32(Count), Name);
+}
+
+//! Sweep - The state of emitting a derived function: the arguments by name, and the derivative of the
+//! result with respect to each of them. In reverse mode, these are the adjoints accumulated so far;
+//! in forward mode, the tangents that were passed in.
+struct Sweep {
+    IRBuilder<> B;
+    Function *F;
+    map<string, unsigned> ArgIndex;
+    vector<Value *> Args;
+    vector<Value *> Derivatives;
+
+    //! Values - The value of every node, recorded by the forward sweep for the reverse sweep, and of
+    //! shared nodes, so that they are only evaluated once.
+    map<const ExprAST *, Value *> Values;
+
+    //! Partials - For every call, the partial derivatives of the callee: a pointer to them for calls to
+    //! definitions, the derivative itself for calls to externs. Tangents - The same in forward mode.
+    map<const CallExprAST *, Value *> Partials;
+    map<const ExprAST *, Value *> Tangents;
+
+    Sweep(Function *F) : B(BasicBlock::Create(F->getContext(), "entry", F)), F(F) {}
+};
+
+static Value *EmitBinary(IRBuilder<> &B, char Op, Value *L, Value *R) {
+    switch (Op) {
+        case '+': {
+            return B.CreateFAdd(L, R, "addtmp");
+        }
+        case '-': {
+            return B.CreateFSub(L, R, "subtmp");
+        }
+        case '*': {
+            return B.CreateFMul(L, R, "multmp");
+        }
+        default: {
+            return B.CreateUIToFP(B.CreateFCmpULT(L, R, "cmptmp"), B.getDoubleTy(), "booltmp");
+        }
+    }
+}
+
+//! EmitPrimal - The forward sweep of reverse mode: evaluate E, recording the value of every node and the
+//! partial derivatives of every call.
+static Value *EmitPrimal(Sweep &S, const ExprAST &E) {
+    Value *V = nullptr;
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            V = ConstantFP::get(S.B.getDoubleTy(), cast<NumberExprAST>(E).getValue());
+            break;
+        }
+        case ExprAST::EK_Variable: {
+            V = S.Args[S.ArgIndex.at(cast<VariableExprAST>(E).getName())];
+            break;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            Value *L = EmitPrimal(S, B.getLHS());
+            Value *R = EmitPrimal(S, B.getRHS());
+            V = EmitBinary(S.B, B.getOp(), L, R);
+            break;
+        }
+        case ExprAST::EK_Shared: {
+            auto &Inner = cast<SharedExprAST>(E).getExpr();
+            auto Known = S.Values.find(&Inner);
+            V = Known != S.Values.end() ? Known->second : EmitPrimal(S, Inner);
+            break;
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            vector<Value *> ArgsV;
+            for (auto &Arg : C.getArgs()) {
+                ArgsV.push_back(EmitPrimal(S, *Arg));
+            }
+
+            if (FunctionDefs.count(C.getCallee())) {
+                Value *Adjoints = CreateEntryAlloca(S.F, static_cast<unsigned>(ArgsV.size()), "adjoints");
+                ArgsV.push_back(Adjoints);
+                V = S.B.CreateCall(GetDerivedFunction(C.getCallee(), DiffMode::Reverse), ArgsV, "calltmp");
+                S.Partials[&C] = Adjoints;
+            } else {
+                V = S.B.CreateCall(getFunction(C.getCallee()), ArgsV, "calltmp");
+                S.Partials[&C] = EmitExternDerivative(S.B, C.getCallee(), ArgsV[0], V);
+            }
+            break;
+        }
+    }
+    S.Values[&E] = V;
+    return V;
+}
+
+//! EmitAdjoint - The reverse sweep: propagate the adjoint of E, the derivative of the result with
+//! respect to the value of E, down to the arguments.
+static void EmitAdjoint(Sweep &S, const ExprAST &E, Value *Adjoint) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            return;
+        }
+        case ExprAST::EK_Variable: {
+            Value *&Derivative = S.Derivatives[S.ArgIndex.at(cast<VariableExprAST>(E).getName())];
+            Derivative = Derivative ? S.B.CreateFAdd(Derivative, Adjoint, "adjtmp") : Adjoint;
+            return;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            switch (B.getOp()) {
+                case '+': {
+                    EmitAdjoint(S, B.getLHS(), Adjoint);
+                    EmitAdjoint(S, B.getRHS(), Adjoint);
+                    return;
+                }
+                case '-': {
+                    EmitAdjoint(S, B.getLHS(), Adjoint);
+                    EmitAdjoint(S, B.getRHS(), S.B.CreateFNeg(Adjoint, "adjtmp"));
+                    return;
+                }
+                case '*': {
+                    EmitAdjoint(S, B.getLHS(), S.B.CreateFMul(Adjoint, S.Values[&B.getRHS()], "adjtmp"));
+                    EmitAdjoint(S, B.getRHS(), S.B.CreateFMul(Adjoint, S.Values[&B.getLHS()], "adjtmp"));
+                    return;
+                }
+                default: {
+                    // Comparisons are piecewise constant.
+                    return;
+                }
+            }
+        }
+        case ExprAST::EK_Shared: {
+            EmitAdjoint(S, cast<SharedExprAST>(E).getExpr(), Adjoint);
+            return;
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            Value *Partials = S.Partials[&C];
+            if (!FunctionDefs.count(C.getCallee())) {
+                EmitAdjoint(S, *C.getArgs()[0], S.B.CreateFMul(Adjoint, Partials, "adjtmp"));
+                return;
+            }
+            for (unsigned i = 0; i != C.getArgs().size(); ++i) {
+                Value *Partial = S.B.CreateLoad(S.B.CreateConstGEP1_32(Partials, i), "partial");
+                EmitAdjoint(S, *C.getArgs()[i], S.B.CreateFMul(Adjoint, Partial, "adjtmp"));
+            }
+            return;
+        }
+    }
+}
+
+//! EmitTangent - Forward mode: evaluate E along with its derivative in the direction of the tangents
+//! of the arguments. Returns the value; the derivative is recorded in Tangents.
+static Value *EmitTangent(Sweep &S, const ExprAST &E) {
+    Type *DoubleTy = S.B.getDoubleTy();
+    Value *V = nullptr;
+    Value *T = ConstantFP::get(DoubleTy, 0.0);
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            V = ConstantFP::get(DoubleTy, cast<NumberExprAST>(E).getValue());
+            break;
+        }
+        case ExprAST::EK_Variable: {
+            unsigned Index = S.ArgIndex.at(cast<VariableExprAST>(E).getName());
+            V = S.Args[Index];
+            T = S.Derivatives[Index];
+            break;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            Value *L = EmitTangent(S, B.getLHS());
+            Value *R = EmitTangent(S, B.getRHS());
+            Value *LT = S.Tangents[&B.getLHS()];
+            Value *RT = S.Tangents[&B.getRHS()];
+            V = EmitBinary(S.B, B.getOp(), L, R);
+            if (B.getOp() == '+' || B.getOp() == '-') {
+                T = EmitBinary(S.B, B.getOp(), LT, RT);
+            } else if (B.getOp() == '*') {
+                T = S.B.CreateFAdd(S.B.CreateFMul(LT, R, "tantmp"), S.B.CreateFMul(L, RT, "tantmp"), "tantmp");
+            }
+            break;
+        }
+        case ExprAST::EK_Shared: {
+            auto &Inner = cast<SharedExprAST>(E).getExpr();
+            auto Known = S.Values.find(&Inner);
+            V = Known != S.Values.end() ? Known->second : EmitTangent(S, Inner);
+            T = S.Tangents[&Inner];
+            break;
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            vector<Value *> ArgsV, TangentsV;
+            for (auto &Arg : C.getArgs()) {
+                ArgsV.push_back(EmitTangent(S, *Arg));
+                TangentsV.push_back(S.Tangents[Arg.get()]);
+            }
+
+            if (FunctionDefs.count(C.getCallee())) {
+                Value *Tangent = CreateEntryAlloca(S.F, 1, "tangent");
+                ArgsV.insert(ArgsV.end(), TangentsV.begin(), TangentsV.end());
+                ArgsV.push_back(Tangent);
+                V = S.B.CreateCall(GetDerivedFunction(C.getCallee(), DiffMode::Forward), ArgsV, "calltmp");
+                T = S.B.CreateLoad(Tangent, "tangent");
+            } else {
+                V = S.B.CreateCall(getFunction(C.getCallee()), ArgsV, "calltmp");
+                T = S.B.CreateFMul(EmitExternDerivative(S.B, C.getCallee(), ArgsV[0], V), TangentsV[0], "tantmp");
+            }
+            break;
+        }
+    }
+    S.Values[&E] = V;
+    S.Tangents[&E] = T;
+    return V;
+}
+
+//! GetDerivedFunction - The derived function of the definition Name in the current module, emitted from
+//! its tree on first use. Name must have passed isDifferentiable.
+static Function *GetDerivedFunction(const string &Name, DiffMode Mode) {
+    string DerivedName = Name + (Mode == DiffMode::Reverse ? ".grad" : ".fwd");
+    if (Function *F = TheModule->getFunction(DerivedName)) {
+        return F;
+    }
+
+    auto &Def = *FunctionDefs.at(Name);
+    auto &ArgNames = Def.getProto().getArgs();
+    unsigned Arity = static_cast<unsigned>(ArgNames.size());
+    Type *DoubleTy = Type::getDoubleTy(TheContext);
+    vector<Type *> Params(Mode == DiffMode::Reverse ? Arity : 2 * Arity, DoubleTy);
+    Params.push_back(DoubleTy->getPointerTo());
+
+    // Declared before the body is emitted, so that recursive calls find it.
+    Function *F = Function::Create(FunctionType::get(DoubleTy, Params, false), Function::InternalLinkage,
+                                   DerivedName, TheModule.get());
+    Sweep S(F);
+    auto Arg = F->arg_begin();
+    for (unsigned i = 0; i != Arity; ++i, ++Arg) {
+        Arg->setName(ArgNames[i]);
+        S.ArgIndex[ArgNames[i]] = i;
+        S.Args.push_back(&*Arg);
+    }
+    if (Mode == DiffMode::Forward) {
+        for (unsigned i = 0; i != Arity; ++i, ++Arg) {
+            Arg->setName("d" + ArgNames[i]);
+            S.Derivatives.push_back(&*Arg);
+        }
+    }
+    Value *Out = &*Arg;
+
+    Value *Result;
+    if (Mode == DiffMode::Reverse) {
+        Result = EmitPrimal(S, Def.getBody());
+        S.Derivatives.assign(Arity, nullptr);
+        EmitAdjoint(S, Def.getBody(), ConstantFP::get(DoubleTy, 1.0));
+        for (unsigned i = 0; i != Arity; ++i) {
+            Value *Adjoint = S.Derivatives[i] ? S.Derivatives[i] : ConstantFP::get(DoubleTy, 0.0);
+            S.B.CreateStore(Adjoint, S.B.CreateConstGEP1_32(Out, i));
+        }
+    } else {
+        Result = EmitTangent(S, Def.getBody());
+        S.B.CreateStore(S.Tangents[&Def.getBody()], Out);
+    }
+    S.B.CreateRet(Result);
+
+    verifyFunction(*F);
+    TheFPM->run(*F);
+    return F;
+}
+
+//! EmitArgumentIndex - The argument index given by V as an integer in [0, Arity).
+static Value *EmitArgumentIndex(IRBuilder<> &Builder, const ExprAST &E, Value *V, unsigned Arity) {
+    // Constant indices, the common case, select the argument directly.
+    if (auto *N = dyn_cast<NumberExprAST>(&E)) {
+        int64_t Index = static_cast<int64_t>(N->getValue()) % Arity;
+        return Builder.getInt64(static_cast<uint64_t>(Index < 0 ? Index + Arity : Index));
+    }
+    Value *Index = Builder.CreateSRem(Builder.CreateFPToSI(V, Builder.getInt64Ty()), Builder.getInt64(Arity));
+    return Builder.CreateSelect(Builder.CreateICmpSLT(Index, Builder.getInt64(0)),
+                                Builder.CreateAdd(Index, Builder.getInt64(Arity)), Index, "argtmp");
+}
+
+//! ReverseBlock/ReversePasses - The adjoint arrays of the f.grad calls emitted into ReverseBlock, keyed by
+//! the function and the signature of its arguments. A grad of the same function at the same pure arguments
+//! loads its partial from the array of the earlier call, so partials by all arguments cost one reverse pass.
+static thread_local BasicBlock *ReverseBlock = nullptr;
+static thread_local map<string, Value *> ReversePasses;
+
+void ResetDiffBuiltins() {
+    ReverseBlock = nullptr;
+    ReversePasses.clear();
+}
+
+//! AppendSignature - Append a key for E to Signature that is equal for structurally equal expressions.
+static void AppendSignature(const ExprAST &E, string &Signature) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            uint64_t Bits;
+            double Value = cast<NumberExprAST>(E).getValue();
+            memcpy(&Bits, &Value, sizeof(Bits));
+            char Buffer[24];
+            snprintf(Buffer, sizeof(Buffer), "%llx", (unsigned long long) Bits);
+            Signature += Buffer;
+            return;
+        }
+        case ExprAST::EK_Variable: {
+            Signature += "$" + cast<VariableExprAST>(E).getName();
+            return;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            Signature += "(";
+            AppendSignature(B.getLHS(), Signature);
+            Signature += B.getOp();
+            AppendSignature(B.getRHS(), Signature);
+            Signature += ")";
+            return;
+        }
+        case ExprAST::EK_Shared: {
+            AppendSignature(cast<SharedExprAST>(E).getExpr(), Signature);
+            return;
+        }
+        case ExprAST::EK_Call: {
+            break;
+        }
+    }
+
+    auto &C = cast<CallExprAST>(E);
+    Signature += C.getCallee() + "(";
+    for (auto &Arg : C.getArgs()) {
+        AppendSignature(*Arg, Signature);
+        Signature += ",";
+    }
+    Signature += ")";
+}
+
+//! ReversePassSignature - The key of the reverse pass of a grad call, or "" if its arguments have side
+//! effects and every call needs a pass of its own.
+static string ReversePassSignature(const CallExprAST &Call) {
+    auto &Args = Call.getArgs();
+    string Signature = cast<VariableExprAST>(*Args[0]).getName() + "(";
+    for (size_t i = 2; i != Args.size(); ++i) {
+        if (!isPureBody("", *Args[i])) {
+            return "";
+        }
+        AppendSignature(*Args[i], Signature);
+        Signature += ",";
+    }
+    return Signature + ")";
+}
+
+Value *EmitDiffBuiltin(IRBuilder<> &Builder, const CallExprAST &Call) {
+    auto &Builtin = Call.getCallee();
+    auto &Args = Call.getArgs();
+    size_t Leading = Builtin == "gradient" ? 1 : 2;
+    if (Args.size() < Leading) {
+        return LogErrorV("Incorrect # arguments passed");
+    }
+    auto *Ref = dyn_cast<VariableExprAST>(Args[0].get());
+    if (!Ref) {
+        return LogErrorV("Expected a function name");
+    }
+
+    set<string> Checked;
+    if (!isDifferentiable(Ref->getName(), Checked)) {
+        return nullptr;
+    }
+    unsigned Arity = static_cast<unsigned>(FunctionDefs[Ref->getName()]->getProto().getArgs().size());
+    if (Arity == 0) {
+        return LogErrorV("Expected a function of at least one argument");
+    }
+    if (Args.size() != Leading + Arity) {
+        return LogErrorV("Incorrect # arguments passed");
+    }
+
+    // The index, then the arguments, in the order they are written.
+    vector<Value *> ArgsV;
+    for (auto &Arg : Args) {
+        if (&Arg == &Args[0]) {
+            continue;
+        }
+        ArgsV.push_back(Arg->codegen());
+        if (!ArgsV.back()) {
+            return nullptr;
+        }
+        if (ArgsV.back()->getType()->isVectorTy()) {
+            return LogErrorV("Argument type does not match the parameter type");
+        }
+    }
+    Value *Index = Leading == 2 ? EmitArgumentIndex(Builder, *Args[1], ArgsV[0], Arity) : nullptr;
+    if (Index) {
+        ArgsV.erase(ArgsV.begin());
+    }
+
+    Function *Caller = Builder.GetInsertBlock()->getParent();
+    Module *M = Caller->getParent();
+    if (Builtin == "gradient") {
+        if (Caller->getName() != "__anon_expr") {
+            return LogErrorV("gradient can only be evaluated at the top level");
+        }
+        if (M->getNamedGlobal(GradientSymbol)) {
+            return LogErrorV("Only one gradient can be evaluated per expression");
+        }
+        ArrayType *GradientTy = ArrayType::get(Builder.getDoubleTy(), Arity);
+        auto *Gradient = new GlobalVariable(*M, GradientTy, false, GlobalValue::ExternalLinkage,
+                                            ConstantAggregateZero::get(GradientTy), GradientSymbol);
+        ArgsV.push_back(Builder.CreateConstGEP2_32(GradientTy, Gradient, 0, 0));
+        return Builder.CreateCall(GetDerivedFunction(Ref->getName(), DiffMode::Reverse), ArgsV, "gradtmp");
+    }
+
+    if (Builtin == "grad") {
+        // Only a pass emitted into the same block is sure to have run before this point.
+        if (Builder.GetInsertBlock() != ReverseBlock) {
+            ResetDiffBuiltins();
+            ReverseBlock = Builder.GetInsertBlock();
+        }
+        string Signature = ReversePassSignature(Call);
+        auto Pass = Signature.empty() ? ReversePasses.end() : ReversePasses.find(Signature);
+        Value *Adjoints = Pass != ReversePasses.end() ? Pass->second : nullptr;
+        if (!Adjoints) {
+            Adjoints = CreateEntryAlloca(Caller, Arity, "adjoints");
+            ArgsV.push_back(Adjoints);
+            Builder.CreateCall(GetDerivedFunction(Ref->getName(), DiffMode::Reverse), ArgsV);
+            if (!Signature.empty()) {
+                ReversePasses[Signature] = Adjoints;
+            }
+        }
+        return Builder.CreateLoad(Builder.CreateGEP(Adjoints, Index), "partial");
+    }
+
+    // Forward mode, seeded with the unit vector of the argument.
+    Type *DoubleTy = Builder.getDoubleTy();
+    for (unsigned i = 0; i != Arity; ++i) {
+        ArgsV.push_back(Builder.CreateSelect(Builder.CreateICmpEQ(Index, Builder.getInt64(i)),
+                                             ConstantFP::get(DoubleTy, 1.0), ConstantFP::get(DoubleTy, 0.0)));
+    }
+    Value *Tangent = CreateEntryAlloca(Caller, 1, "tangent");
+    ArgsV.push_back(Tangent);
+    Builder.CreateCall(GetDerivedFunction(Ref->getName(), DiffMode::Forward), ArgsV);
+    return Builder.CreateLoad(Tangent, "partial");
+}
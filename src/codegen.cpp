@@ -2,6 +2,7 @@
 // Created by Markus on 13.07.2016.
 //
 
+#include <chrono>
 #include <memory>
 #include <map>
 #include <llvm/IR/IRBuilder.h>
@@ -10,30 +11,41 @@
 #include "codegen.h"
 #include "parser.h"
 #include "jit.h"
+#include "analysis.h"
+#include "memo.h"
+#include "tiered.h"
+#include "parallel.h"
+#include "hashcons.h"
+#include "profile.h"
+#include "simd.h"
+#include "autodiff.h"
+#include "helper.h"
 
 using namespace std;
 using namespace llvm;
 
 //! TheContext is an opaque object that owns a lot of core LLVM data structures,
 //! such as the type and constant value tables.
-LLVMContext TheContext;
+thread_local LLVMContext TheContext;
 
 //! The Builder object is a helper object that makes it easy to generate LLVM instructions.
 //! Instances of the IRBuilder class template keep track of the current place to insert instructions and has
 //! methods to create new instructions.
-static IRBuilder<> Builder(TheContext);
+static thread_local IRBuilder<> Builder(TheContext);
 
 //! TheModule is an LLVM construct that contains functions and global variables. In many ways, it is the top-level
 //! structure that the LLVM IR uses to contain code.
 //! It will own the memory for all of the IR that we generate, which is why the codegen() method returns
 //! a raw Value*, rather than a unique_ptr<Value>.
-unique_ptr<Module> TheModule;
+thread_local unique_ptr<Module> TheModule;
 
 //! The NamedValues map keeps track of which values are defined in the current scope and what their
 //! LLVM representation is. (In other words, it is a symbol table for the code).
-static map<string, Value *> NamedValues;
+static thread_local map<string, Value *> NamedValues;
 
-map<string, unique_ptr<PrototypeAST>> FunctionProtos;
+thread_local map<string, unique_ptr<PrototypeAST>> FunctionProtos;
+
+thread_local map<string, unique_ptr<FunctionAST>> FunctionDefs;
 
 Value *LogErrorV(const char *Str) {
     LogError(Str);
@@ -60,6 +72,18 @@ Value *BinaryExprAST::codegen() {
         return nullptr;
     }
 
+    // Operators work element-wise on vectors, with scalar operands splatted to every lane.
+    if (L->getType() != R->getType()) {
+        if (L->getType()->isVectorTy() && R->getType()->isVectorTy()) {
+            return LogErrorV("Operands are vectors of different widths");
+        }
+        if (L->getType()->isVectorTy()) {
+            R = EmitSplat(Builder, R, L);
+        } else {
+            L = EmitSplat(Builder, L, R);
+        }
+    }
+
     switch (_op) {
         case '+': {
             return Builder.CreateFAdd(L, R, "addtmp");
@@ -72,8 +96,8 @@ Value *BinaryExprAST::codegen() {
         }
         case '<': {
             L = Builder.CreateFCmpULT(L, R, "cmptmp");
-            // Convert bool 0/1 to double 0.0 or 1.0
-            return Builder.CreateUIToFP(L, Type::getDoubleTy(TheContext), "booltmp");
+            // Convert bool 0/1 to double 0.0 or 1.0, lane by lane for vectors
+            return Builder.CreateUIToFP(L, R->getType(), "booltmp");
         }
         default: {
             return LogErrorV("invalid binary operator");
@@ -99,8 +123,22 @@ Function *getFunction(string Name) {
 }
 
 Value *CallExprAST::codegen() {
-    // Look up the name in the global module table.
-    Function *CalleeF = getFunction(_callee);
+    // The builtins, unless shadowed by a user function of the same name.
+    if (isParallelBuiltin(_callee)) {
+        return EmitParallelBuiltin(Builder, *this);
+    }
+    if (isVectorBuiltin(_callee)) {
+        return EmitVectorBuiltin(Builder, *this);
+    }
+    if (isDiffBuiltin(_callee)) {
+        return EmitDiffBuiltin(Builder, *this);
+    }
+
+    // Look up the name in the global module table, unless the call is redirected to
+    // a local copy of the callee in the current module.
+    auto Redirect = CallRedirects.find(_callee);
+    Function *CalleeF = Redirect != CallRedirects.end() ? TheModule->getFunction(Redirect->second)
+                                                        : getFunction(_callee);
     if (!CalleeF) {
         return LogErrorV("Unknown function referenced");
     }
@@ -116,17 +154,41 @@ Value *CallExprAST::codegen() {
         if (!ArgsV.back()) {
             return nullptr;
         }
+        if (ArgsV.back()->getType() != CalleeF->getFunctionType()->getParamType(i)) {
+            return LogErrorV("Argument type does not match the parameter type");
+        }
+    }
+
+    // Tiered functions are called through their slot, so that they can be swapped
+    // for optimized code later on.
+    if (Redirect == CallRedirects.end()) {
+        if (TierSlot *Slot = FindTierSlot(_callee)) {
+            return EmitSlotCall(Builder, *Slot, CalleeF, ArgsV);
+        }
     }
 
     return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
 }
 
-Function *PrototypeAST::codegen() {
-    // Make the function type:  double(double,double) etc.
-    std::vector<Type *> Doubles(_args.size(), Type::getDoubleTy(TheContext));
-    FunctionType *FT = FunctionType::get(Type::getDoubleTy(TheContext), Doubles, false);
+Value *SharedExprAST::codegen() {
+    // The first reference generates the code, which dominates all later references.
+    if (!_cell->Generated) {
+        _cell->Generated = _cell->Expr->codegen();
+    }
+    return _cell->Generated;
+}
 
-    Function *F = Function::Create(FT, Function::ExternalLinkage, _name, TheModule.get());
+FunctionType *PrototypeAST::getFunctionType() const {
+    // Make the function type:  double(double,double), <4 x double>(<4 x double>,double) etc.
+    std::vector<Type *> Params;
+    for (auto VT : _types) {
+        Params.push_back(getLLVMType(VT));
+    }
+    return FunctionType::get(getLLVMType(_returnType), Params, false);
+}
+
+Function *PrototypeAST::codegen() {
+    Function *F = Function::Create(getFunctionType(), Function::ExternalLinkage, _name, TheModule.get());
 
     // Set names for all arguments.
     unsigned Idx = 0;
@@ -137,40 +199,140 @@ Function *PrototypeAST::codegen() {
     return F;
 }
 
-Function *FunctionAST::codegen() {
-    // Transfer ownership of the prototype to the FunctionProtos map, but keep a
-    // reference to it for use below.
-    auto &P = *_proto;
-    FunctionProtos[_proto->getName()] = move(_proto);
-    Function *TheFunction = getFunction(P.getName());
-    if (!TheFunction) {
-        return nullptr;
+static size_t CountInstructions(const Function *F) {
+    size_t Count = 0;
+    for (auto &BB : *F) {
+        Count += BB.size();
     }
+    return Count;
+}
+
+static double SecondsSince(chrono::steady_clock::time_point Start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+}
 
+//! EmitBody - Generate the body of the empty function F from a definition's body expression.
+//! If a tier slot is given, the function starts by counting its calls in that slot.
+static bool EmitBody(Function *F, const PrototypeAST &P, ExprAST &Body, TierSlot *Slot) {
     // Create a new basic block to start insertion into.
-    BasicBlock *BB = BasicBlock::Create(TheContext, "entry", TheFunction);
+    BasicBlock *BB = Slot ? EmitTierUpCheck(F, *Slot) : BasicBlock::Create(TheContext, "entry", F);
     Builder.SetInsertPoint(BB);
+    ProfileFrame Frame = EmitProfileEntry(Builder, P.getName());
+
+    ResetDiffBuiltins();
 
     // Record the function arguments in the NamedValues map.
     NamedValues.clear();
-    for (auto &Arg : TheFunction->args()) {
+    unsigned Idx = 0;
+    for (auto &Arg : F->args()) {
+        Arg.setName(P.getArgs()[Idx++]);
         NamedValues[Arg.getName()] = &Arg;
     }
 
-    if (Value *RetVal = _body->codegen()) {
+    unique_ptr<ExprAST> Shared = HashConsEnabled ? HashCons(Body) : nullptr;
+    if (Value *RetVal = (Shared ? *Shared : Body).codegen()) {
+        if (RetVal->getType() != F->getReturnType()) {
+            LogErrorV("Function body does not have the inferred result type");
+            return false;
+        }
+
         // Finish off the function.
+        EmitProfileExit(Builder, Frame);
         Builder.CreateRet(RetVal);
 
         // Validate the generated code, checking for consistency, defined in llvm/IR/Verifier.h
-        verifyFunction(*TheFunction);
+        verifyFunction(*F);
+        return true;
+    }
+    return false;
+}
+
+Function *FunctionAST::codegen(bool Tier0) {
+    // Memoization is only sound if the result depends on nothing but the arguments.
+    if (_memo && !isPureBody(_proto->getName(), *_body)) {
+        LogError("memo requires a pure function (no calls to externs or impure definitions)");
+        return nullptr;
+    }
+
+    // The cache stores one double per argument and result.
+    _proto->setReturnType(InferType(*_body, *_proto));
+    if (_memo && !_proto->isScalar()) {
+        LogError("memo requires a function of doubles");
+        return nullptr;
+    }
+
+    // Register a copy of the prototype in the FunctionProtos map, keeping the
+    // definition intact so that it can be compiled again later.
+    auto &P = *_proto;
+    FunctionProtos[P.getName()] = helper::make_unique<PrototypeAST>(P);
+    Function *TheFunction = getFunction(P.getName());
+    if (!TheFunction) {
+        return nullptr;
+    }
 
-        // Optimize the function.
+    // A memoized function keeps its public name for the cache lookup; the actual body
+    // goes into an internal function that is only called on a cache miss.
+    Function *BodyFunction = TheFunction;
+    if (_memo) {
+        BodyFunction = Function::Create(TheFunction->getFunctionType(), Function::InternalLinkage,
+                                        P.getName() + ".body", TheModule.get());
+    }
+
+    // Tier 0 code counts its calls so that it can be recompiled once it gets hot. Memoized definitions
+    // go without a slot, and so does a definition compiled without tiering whose predecessor had one.
+    TierSlot *Slot = Tier0 && !_memo ? CreateTierSlot(P.getName()) : nullptr;
+    if (!Slot && FindTierSlot(P.getName())) {
+        SkipTierSlot(P.getName());
+    }
+
+    auto Start = chrono::steady_clock::now();
+    if (EmitBody(BodyFunction, P, *_body, Slot)) {
+        if (_memo) {
+            EmitMemoWrapper(TheFunction, BodyFunction);
+            verifyFunction(*TheFunction);
+        }
+        if (Slot) {
+            EmitTier0Alias(TheFunction, *Slot);
+        }
+        double GenerateSeconds = SecondsSince(Start);
+        size_t Emitted = CountInstructions(TheFunction) + (_memo ? CountInstructions(BodyFunction) : 0);
+
+        // Optimize the function with the light per-function pipeline, tier 0 code included; only tier 1
+        // code gets the full pipeline.
+        Start = chrono::steady_clock::now();
+        if (_memo) {
+            TheFPM->run(*BodyFunction);
+        }
         TheFPM->run(*TheFunction);
+        size_t Optimized = CountInstructions(TheFunction) + (_memo ? CountInstructions(BodyFunction) : 0);
+        RecordCodegen(GenerateSeconds, SecondsSince(Start), Emitted, Optimized);
+
+        // Remember whether this definition is free of side effects.
+        if (isPureBody(P.getName(), *_body)) {
+            PureFunctions.insert(P.getName());
+        } else {
+            PureFunctions.erase(P.getName());
+        }
 
         return TheFunction;
     }
 
     // Error reading body, remove function.
+    DiscardTierSlot(P.getName());
+    if (BodyFunction != TheFunction) {
+        BodyFunction->eraseFromParent();
+    }
     TheFunction->eraseFromParent();
     return nullptr;
-}
\ No newline at end of file
+}
+
+Function *FunctionAST::codegenClone(const string &Name, GlobalValue::LinkageTypes Linkage) {
+    _proto->setReturnType(InferType(*_body, *_proto));
+    Function *F = Function::Create(_proto->getFunctionType(), Linkage, Name, TheModule.get());
+    if (EmitBody(F, *_proto, *_body, nullptr)) {
+        return F;
+    }
+
+    F->eraseFromParent();
+    return nullptr;
+}
@@ -0,0 +1,175 @@
+//
+// Dependency graph between definitions, driving incremental recompilation.
+//
+
+#include <map>
+#include <vector>
+
+#include "depgraph.h"
+#include "analysis.h"
+#include "codegen.h"
+#include "optimizer.h"
+#include "memo.h"
+#include "peval.h"
+#include "tiered.h"
+#include "session.h"
+#include "helper.h"
+
+//! Callees/Callers - The edges of the call graph between definitions, in both directions.
+static thread_local map<string, set<string>> Callees;
+static thread_local map<string, set<string>> Callers;
+
+static void UpdateEdges(const string &Name) {
+    for (auto &Callee : Callees[Name]) {
+        Callers[Callee].erase(Name);
+    }
+
+    set<string> NewCallees;
+    collectCallees(FunctionDefs[Name]->getBody(), NewCallees);
+    for (auto &Callee : NewCallees) {
+        Callers[Callee].insert(Name);
+    }
+    Callees[Name] = move(NewCallees);
+}
+
+static void RemoveDefinition(const string &Name) {
+    for (auto &Callee : Callees[Name]) {
+        Callers[Callee].erase(Name);
+    }
+    Callees.erase(Name);
+
+    FunctionDefs.erase(Name);
+    FunctionProtos.erase(Name);
+    PureFunctions.erase(Name);
+    SetCurrentMemoCache(Name, nullptr);
+}
+
+set<string> GetDependents(const string &Name) {
+    set<string> Dependents;
+    vector<string> Worklist(1, Name);
+    while (!Worklist.empty()) {
+        string Callee = Worklist.back();
+        Worklist.pop_back();
+
+        for (auto &Caller : Callers[Callee]) {
+            if (Caller != Name && FunctionDefs.count(Caller) && Dependents.insert(Caller).second) {
+                Worklist.push_back(Caller);
+            }
+        }
+    }
+    return Dependents;
+}
+
+//! UpdatePurity - Recompute which of the given definitions are pure before any of them is compiled, so that
+//! partial evaluation and the memo check of each one see the final purity of the others, whatever order they
+//! are compiled in. Starts from all of them being pure and removes the ones that call something impure until
+//! nothing changes, which keeps mutually recursive pure definitions pure.
+static void UpdatePurity(const set<string> &Names) {
+    for (auto &Name : Names) {
+        PureFunctions.insert(Name);
+    }
+
+    bool Changed = true;
+    while (Changed) {
+        Changed = false;
+        for (auto &Name : Names) {
+            if (PureFunctions.count(Name) && !isPureBody(Name, FunctionDefs[Name]->getBody())) {
+                PureFunctions.erase(Name);
+                Changed = true;
+            }
+        }
+    }
+}
+
+//! RecompileDefinitions - Compile the given definitions together into one module, so that they bind
+//! to each other's new code even if they call each other. Definitions that fail to compile are
+//! removed and the remaining ones are compiled again. Returns the names that were dropped.
+static set<string> RecompileDefinitions(set<string> Names) {
+    set<string> Dropped;
+    while (!Names.empty()) {
+        UpdatePurity(Names);
+
+        // What an attempt replaces, to be put back if it is thrown away.
+        map<string, PrototypeAST> Protos;
+        map<string, MemoCache *> Caches;
+        for (auto &Name : Names) {
+            Protos.emplace(Name, *FunctionProtos.at(Name));
+            Caches[Name] = GetMemoCache(Name);
+        }
+
+        vector<string> Failed;
+        for (auto &Name : Names) {
+            auto &Def = FunctionDefs[Name];
+            auto Evaluated = PartiallyEvaluate(*Def, Names);
+            if (!(Evaluated ? Evaluated : Def)->codegen(TieredCompilationEnabled)) {
+                Failed.push_back(Name);
+            }
+        }
+
+        if (Failed.empty()) {
+            TheJIT->addModule(move(TheModule));
+            InitializeModuleAndPassManager();
+            for (auto &Name : Names) {
+                PublishTierSlot(Name);
+            }
+            return Dropped;
+        }
+
+        // Start over with a fresh module without the definitions that failed.
+        for (auto &Name : Names) {
+            DiscardTierSlot(Name);
+            FunctionProtos[Name] = helper::make_unique<PrototypeAST>(Protos.at(Name));
+            SetCurrentMemoCache(Name, Caches[Name]);
+        }
+        InitializeModuleAndPassManager();
+        for (auto &Name : Failed) {
+            fprintf(ReplOut, "LogError: '%s' no longer compiles against the new definitions and was removed\n",
+                    Name.c_str());
+            RemoveDefinition(Name);
+            Names.erase(Name);
+            Dropped.insert(Name);
+        }
+    }
+    return Dropped;
+}
+
+void UpdateDefinition(const string &Name) {
+    bool Redefined = Callees.count(Name) != 0;
+    UpdateEdges(Name);
+    if (!Redefined) {
+        return;
+    }
+
+    set<string> Dependents = GetDependents(Name);
+    if (!Dependents.empty()) {
+        set<string> Dropped = RecompileDefinitions(Dependents);
+        fprintf(ReplOut, "Recompiled %u dependent(s) of %s\n",
+                (unsigned) (Dependents.size() - Dropped.size()), Name.c_str());
+    }
+}
+
+void RestoreDefinitions(const set<string> &Names) {
+    for (auto &Name : Names) {
+        UpdateEdges(Name);
+    }
+}
+
+void ResetDependencyGraph() {
+    Callees.clear();
+    Callers.clear();
+}
+
+void PrintDependencies() {
+    for (auto &Def : FunctionDefs) {
+        auto &Name = Def.first;
+        fprintf(ReplOut, "%s: calls", Name.c_str());
+        for (auto &Callee : Callees[Name]) {
+            fprintf(ReplOut, " %s", Callee.c_str());
+        }
+        fprintf(ReplOut, "; called by");
+        for (auto &Caller : Callers[Name]) {
+            fprintf(ReplOut, " %s", Caller.c_str());
+        }
+        fprintf(ReplOut, "\n");
+    }
+}
@@ -0,0 +1,82 @@
+//
+// Reclaiming the JIT code and runtime data of superseded definitions.
+//
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "gc.h"
+#include "codegen.h"
+#include "jit.h"
+#include "memo.h"
+#include "peval.h"
+#include "tiered.h"
+#include "session.h"
+
+//! GarbageStats - Counters reported by the :memory command.
+struct GarbageStats {
+    unsigned long Collections = 0;
+    unsigned long Modules = 0;
+    unsigned long ModuleBytes = 0;
+    unsigned long MemoCaches = 0;
+    unsigned long MemoCacheBytes = 0;
+    unsigned long TierSlots = 0;
+    unsigned long TierSlotBytes = 0;
+    double Seconds = 0;
+};
+
+static thread_local GarbageStats Stats;
+
+void CollectGarbage() {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    auto Start = chrono::steady_clock::now();
+
+    vector<string> Roots;
+    for (auto &Def : FunctionDefs) {
+        Roots.push_back(Def.first);
+    }
+
+    uint64_t ModuleBytes = 0;
+    Stats.Modules += TheJIT->collectGarbage(Roots, ModuleBytes);
+    Stats.ModuleBytes += ModuleBytes;
+
+    // Caches can only go once the modules that refer to them are gone.
+    uint64_t CacheBytes = 0;
+    Stats.MemoCaches += CollectMemoCaches(CacheBytes);
+    Stats.MemoCacheBytes += CacheBytes;
+
+    // Likewise for the slots of superseded tiered definitions.
+    uint64_t SlotBytes = 0;
+    Stats.TierSlots += CollectTierSlots(SlotBytes);
+    Stats.TierSlotBytes += SlotBytes;
+
+    // Cached specializations whose clones went with their modules must be compiled afresh when needed.
+    CollectSpecializations();
+
+    ++Stats.Collections;
+    Stats.Seconds += chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+}
+
+void ResetGarbageStats() {
+    Stats = GarbageStats();
+}
+
+void PrintMemoryStats() {
+    size_t Caches;
+    uint64_t CacheBytes;
+    GetMemoCacheUsage(Caches, CacheBytes);
+    size_t Slots;
+    uint64_t SlotBytes;
+    GetTierSlotUsage(Slots, SlotBytes);
+
+    fprintf(ReplOut, "memory: %lu live modules taking %llu bytes, %lu memo caches taking %llu bytes, "
+                     "%lu tier slots taking %llu bytes\n",
+            (unsigned long) TheJIT->getModuleCount(), (unsigned long long) TheJIT->getModuleBytes(),
+            (unsigned long) Caches, (unsigned long long) CacheBytes,
+            (unsigned long) Slots, (unsigned long long) SlotBytes);
+    fprintf(ReplOut, "  %lu collections in %.3f ms reclaimed %lu modules (%lu bytes), %lu memo caches (%lu bytes)"
+                     " and %lu tier slots (%lu bytes)\n",
+            Stats.Collections, Stats.Seconds * 1e3, Stats.Modules, Stats.ModuleBytes,
+            Stats.MemoCaches, Stats.MemoCacheBytes, Stats.TierSlots, Stats.TierSlotBytes);
+}
@@ -0,0 +1,178 @@
+//
+// Hash-consing of expression trees into DAGs, and the code size statistics to measure it.
+//
+
+#include <unordered_map>
+#include <vector>
+
+#include "hashcons.h"
+#include "analysis.h"
+#include "session.h"
+#include "simd.h"
+#include "helper.h"
+
+bool HashConsEnabled = false;
+
+//! CodegenStats - Counters reported by the :codegen command.
+struct CodegenStats {
+    unsigned long Functions = 0;
+    unsigned long EmittedInstructions = 0;
+    unsigned long OptimizedInstructions = 0;
+    double GenerateSeconds = 0;
+    double OptimizeSeconds = 0;
+
+    unsigned long TreeNodes = 0;
+    unsigned long DagNodes = 0;
+    unsigned long SharedReferences = 0;
+};
+
+static thread_local CodegenStats Stats;
+
+//! HashConsContext - The state of one hash-consing pass. Every structurally distinct subexpression
+//! gets an id; the first walk counts how often each id occurs, the second one builds the DAG.
+struct HashConsContext {
+    unordered_map<string, unsigned> Ids;
+    unordered_map<const ExprAST *, unsigned> NodeIds;
+    vector<unsigned> Occurrences;
+    vector<shared_ptr<SharedExprAST::Cell>> Cells;
+    unsigned UniqueCalls = 0;
+};
+
+static void AppendId(string &Key, unsigned Id) {
+    Key.append(reinterpret_cast<const char *>(&Id), sizeof(Id));
+}
+
+static unsigned Intern(const ExprAST &E, HashConsContext &Ctx) {
+    string Key;
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            double Value = cast<NumberExprAST>(E).getValue();
+            Key = "n";
+            Key.append(reinterpret_cast<const char *>(&Value), sizeof(Value));
+            break;
+        }
+        case ExprAST::EK_Variable: {
+            Key = "v" + cast<VariableExprAST>(E).getName();
+            break;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            unsigned LHS = Intern(B.getLHS(), Ctx);
+            unsigned RHS = Intern(B.getRHS(), Ctx);
+            Key = "b";
+            Key += B.getOp();
+            AppendId(Key, LHS);
+            AppendId(Key, RHS);
+            break;
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            vector<unsigned> Args;
+            for (auto &Arg : C.getArgs()) {
+                Args.push_back(Intern(*Arg, Ctx));
+            }
+
+            // Calls with side effects are all distinct.
+            if (!PureFunctions.count(C.getCallee()) && !isVectorBuiltin(C.getCallee())) {
+                Key = "i";
+                AppendId(Key, Ctx.UniqueCalls++);
+                break;
+            }
+            Key = "c" + C.getCallee();
+            Key += '\0';
+            for (unsigned Arg : Args) {
+                AppendId(Key, Arg);
+            }
+            break;
+        }
+        case ExprAST::EK_Shared: {
+            unsigned Id = Intern(cast<SharedExprAST>(E).getExpr(), Ctx);
+            Ctx.NodeIds[&E] = Id;
+            return Id;
+        }
+    }
+
+    auto Inserted = Ctx.Ids.insert(make_pair(move(Key), static_cast<unsigned>(Ctx.Ids.size())));
+    unsigned Id = Inserted.first->second;
+    if (Inserted.second) {
+        Ctx.Occurrences.push_back(0);
+    }
+    ++Ctx.Occurrences[Id];
+    Ctx.NodeIds[&E] = Id;
+    ++Stats.TreeNodes;
+    return Id;
+}
+
+static unique_ptr<ExprAST> Build(const ExprAST &E, HashConsContext &Ctx);
+
+static unique_ptr<ExprAST> Copy(const ExprAST &E, HashConsContext &Ctx) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            return helper::make_unique<NumberExprAST>(cast<NumberExprAST>(E).getValue());
+        }
+        case ExprAST::EK_Variable: {
+            return helper::make_unique<VariableExprAST>(cast<VariableExprAST>(E).getName());
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            auto LHS = Build(B.getLHS(), Ctx);
+            auto RHS = Build(B.getRHS(), Ctx);
+            return helper::make_unique<BinaryExprAST>(B.getOp(), move(LHS), move(RHS));
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            vector<unique_ptr<ExprAST>> Args;
+            for (auto &Arg : C.getArgs()) {
+                Args.push_back(Build(*Arg, Ctx));
+            }
+            return helper::make_unique<CallExprAST>(C.getCallee(), move(Args));
+        }
+        case ExprAST::EK_Shared: {
+            return Build(cast<SharedExprAST>(E).getExpr(), Ctx);
+        }
+    }
+    return nullptr;
+}
+
+static unique_ptr<ExprAST> Build(const ExprAST &E, HashConsContext &Ctx) {
+    // Numbers and variables generate no instructions, so sharing them gains nothing.
+    unsigned Id = Ctx.NodeIds[&E];
+    if (Ctx.Occurrences[Id] < 2 || isa<NumberExprAST>(E) || isa<VariableExprAST>(E)) {
+        return Copy(E, Ctx);
+    }
+
+    if (!Ctx.Cells[Id]) {
+        auto Cell = make_shared<SharedExprAST::Cell>();
+        Cell->Expr = Copy(E, Ctx);
+        Ctx.Cells[Id] = move(Cell);
+    } else {
+        ++Stats.SharedReferences;
+    }
+    return helper::make_unique<SharedExprAST>(Ctx.Cells[Id]);
+}
+
+unique_ptr<ExprAST> HashCons(const ExprAST &E) {
+    HashConsContext Ctx;
+    Intern(E, Ctx);
+    Ctx.Cells.resize(Ctx.Ids.size());
+    Stats.DagNodes += Ctx.Ids.size();
+    return Build(E, Ctx);
+}
+
+void RecordCodegen(double GenerateSeconds, double OptimizeSeconds, size_t Emitted, size_t Optimized) {
+    ++Stats.Functions;
+    Stats.GenerateSeconds += GenerateSeconds;
+    Stats.OptimizeSeconds += OptimizeSeconds;
+    Stats.EmittedInstructions += Emitted;
+    Stats.OptimizedInstructions += Optimized;
+}
+
+void PrintCodegenStats() {
+    fprintf(ReplOut, "codegen: %lu functions, %lu IR instructions emitted, %lu after optimization\n",
+            Stats.Functions, Stats.EmittedInstructions, Stats.OptimizedInstructions);
+    fprintf(ReplOut, "  %.3f ms generating IR, %.3f ms optimizing\n",
+            Stats.GenerateSeconds * 1e3, Stats.OptimizeSeconds * 1e3);
+    fprintf(ReplOut, "  hash-consing %s: %lu tree nodes, %lu distinct, %lu shared references\n",
+            HashConsEnabled ? "enabled" : "disabled",
+            Stats.TreeNodes, Stats.DagNodes, Stats.SharedReferences);
+}
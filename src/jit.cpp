@@ -8,4 +8,6 @@
 
 using namespace llvm::orc;
 
-unique_ptr<KaleidoscopeJIT> TheJIT;
+thread_local unique_ptr<KaleidoscopeJIT> TheJIT;
+
+thread_local recursive_mutex CompileMutex;
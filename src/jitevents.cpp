@@ -0,0 +1,164 @@
+//
+// Registration of JIT'd code with profilers and debuggers.
+//
+
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Object/SymbolSize.h>
+
+#include "jitevents.h"
+
+bool JITEventsEnabled = false;
+
+//! PerfMapEntry - A function in the perf map: where its code starts, how long it is, and its name.
+struct PerfMapEntry {
+    uint64_t Address;
+    uint64_t Size;
+    string Name;
+};
+
+//! JITEventObserver - Forwards linked and removed objects to the JIT event listeners, and keeps
+//! the perf map in step with the code that is currently loaded. Sessions run on several threads,
+//! so everything is guarded by one mutex.
+class JITEventObserver : public orc::JITObjectObserver {
+public:
+    JITEventObserver() {
+        for (auto *Listener : {JITEventListener::createGDBRegistrationListener(),
+                               JITEventListener::createIntelJITEventListener(),
+                               JITEventListener::createOProfileJITEventListener()}) {
+            if (Listener) {
+                Listeners.push_back(Listener);
+            }
+        }
+
+        char Path[64];
+        snprintf(Path, sizeof(Path), "/tmp/perf-%d.map", static_cast<int>(getpid()));
+        PerfMapPath = Path;
+        remove(PerfMapPath.c_str());
+    }
+
+    void objectLoaded(const void *Key, const object::ObjectFile &Obj,
+                      const RuntimeDyld::LoadedObjectInfo &Info) override {
+        lock_guard<mutex> Lock(Mutex);
+        for (auto *Listener : Listeners) {
+            Listener->NotifyObjectEmitted(Obj, Info);
+        }
+
+        LoadedObject &Loaded = Objects[Key];
+        Loaded.Objects.push_back(&Obj);
+        collectFunctions(Obj, Info, Loaded.Entries);
+        appendPerfMap(Loaded.Entries);
+    }
+
+    void objectRemoved(const void *Key) override {
+        lock_guard<mutex> Lock(Mutex);
+        auto Loaded = Objects.find(Key);
+        if (Loaded == Objects.end()) {
+            // The object was never linked, since nothing looked up its symbols.
+            return;
+        }
+
+        for (auto *Obj : Loaded->second.Objects) {
+            for (auto *Listener : Listeners) {
+                Listener->NotifyFreeingObject(*Obj);
+            }
+        }
+        bool HadEntries = !Loaded->second.Entries.empty();
+        Objects.erase(Loaded);
+        if (HadEntries) {
+            rewritePerfMap();
+        }
+    }
+
+private:
+    struct LoadedObject {
+        vector<const object::ObjectFile *> Objects;
+        vector<PerfMapEntry> Entries;
+    };
+
+    //! collectFunctions - Add the functions defined by Obj, at the addresses they were loaded to.
+    static void collectFunctions(const object::ObjectFile &Obj, const RuntimeDyld::LoadedObjectInfo &Info,
+                                 vector<PerfMapEntry> &Entries) {
+        // The debug object has the section addresses patched to where the sections were loaded.
+        object::OwningBinary<object::ObjectFile> DebugObj = Info.getObjectForDebug(Obj);
+        if (!DebugObj.getBinary()) {
+            return;
+        }
+
+        for (auto &SymbolAndSize : object::computeSymbolSizes(*DebugObj.getBinary())) {
+            const object::SymbolRef &Symbol = SymbolAndSize.first;
+            Expected<object::SymbolRef::Type> Type = Symbol.getType();
+            if (!Type) {
+                consumeError(Type.takeError());
+                continue;
+            }
+            if (*Type != object::SymbolRef::ST_Function) {
+                continue;
+            }
+
+            Expected<StringRef> Name = Symbol.getName();
+            if (!Name) {
+                consumeError(Name.takeError());
+                continue;
+            }
+            Expected<uint64_t> Address = Symbol.getAddress();
+            if (!Address) {
+                consumeError(Address.takeError());
+                continue;
+            }
+            Entries.push_back(PerfMapEntry{*Address, SymbolAndSize.second, Name->str()});
+        }
+    }
+
+    static void writeEntries(FILE *File, const vector<PerfMapEntry> &Entries) {
+        for (auto &Entry : Entries) {
+            fprintf(File, "%" PRIx64 " %" PRIx64 " %s\n", Entry.Address, Entry.Size, Entry.Name.c_str());
+        }
+    }
+
+    void appendPerfMap(const vector<PerfMapEntry> &Entries) {
+        if (Entries.empty()) {
+            return;
+        }
+        if (FILE *File = fopen(PerfMapPath.c_str(), "a")) {
+            writeEntries(File, Entries);
+            fclose(File);
+        }
+    }
+
+    //! rewritePerfMap - Write the map of everything that is still loaded, so that the addresses of
+    //! removed functions can not be attributed to them when they are reused. The new map replaces
+    //! the old one atomically, in case perf reads it meanwhile.
+    void rewritePerfMap() {
+        string TempPath = PerfMapPath + ".tmp";
+        FILE *File = fopen(TempPath.c_str(), "w");
+        if (!File) {
+            return;
+        }
+        for (auto &Loaded : Objects) {
+            writeEntries(File, Loaded.second.Entries);
+        }
+        fclose(File);
+        rename(TempPath.c_str(), PerfMapPath.c_str());
+    }
+
+    mutex Mutex;
+    vector<JITEventListener *> Listeners;
+    map<const void *, LoadedObject> Objects;
+    string PerfMapPath;
+};
+
+orc::JITObjectObserver *GetJITEventObserver() {
+    if (!JITEventsEnabled) {
+        return nullptr;
+    }
+
+    // The listeners outlive every session, so the observer is never destroyed.
+    static JITEventObserver *Observer = new JITEventObserver();
+    return Observer;
+}
@@ -2,69 +2,220 @@
 // Created by Markus on 13.07.2016.
 //
 
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
 #include "lexer.h"
+#include "session.h"
+
+thread_local int CurTok;
+
+//! Tokens/TokPos - The token buffer of the current thread, and the index of the token after CurTok.
+static thread_local TokenBuffer Tokens;
+static thread_local size_t TokPos = 0;
 
-string IdentifierStr; // Filled in if Identifier
-double NumVal;        // Filled in if Number
-int CurTok;
+//! InputMode - How the input is read: line by line if it is interactive, so that nothing is read
+//! before it was typed, and all at once otherwise.
+enum class InputMode {
+    Unknown,
+    Lines,
+    Whole,
+};
 
-//! getToken - Return the next token from standard input.
-int getToken() {
-    static int lastChar = ' ';
+static thread_local InputMode Mode = InputMode::Unknown;
 
-    // Skip any whitespace.
-    while (isspace(lastChar)) {
-        lastChar = getchar();
+//! CompactThreshold - Consumed tokens are only released once there are at least this many of them,
+//! and they make up at least half of the buffer, so that moving the rest is paid for.
+static const size_t CompactThreshold = 4096;
+
+static int KeywordKind(const char *Text, size_t Length) {
+    if (Length == 3 && memcmp(Text, "def", 3) == 0) {
+        return static_cast<int>(Token::FunctionDefinition);
+    }
+    if (Length == 6 && memcmp(Text, "extern", 6) == 0) {
+        return static_cast<int>(Token::ExternKeyword);
     }
+    return static_cast<int>(Token::Identifier);
+}
 
-    if (isalpha(lastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
-        IdentifierStr = lastChar;
-        while (isalnum((lastChar = getchar()))) {
-            IdentifierStr += lastChar;
-        }
+void TokenBuffer::tokenize(size_t From) {
+    const unsigned char *Text = reinterpret_cast<const unsigned char *>(Source.data());
+    size_t End = Source.size();
+    size_t i = From;
+
+    auto Push = [&](int Kind, size_t Start, double Number) {
+        Kinds.push_back(Kind);
+        Offsets.push_back(static_cast<uint32_t>(Start));
+        Lengths.push_back(static_cast<uint32_t>(i - Start));
+        Numbers.push_back(Number);
+    };
 
-        if (IdentifierStr == "def") {
-            return static_cast<int>(Token::FunctionDefinition);
+    while (i < End) {
+        unsigned char C = Text[i];
+        if (C == '\n') {
+            ++i;
+            LineStarts.push_back(SourceBase + i);
+            continue;
         }
-        if (IdentifierStr == "extern") {
-            return static_cast<int>(Token::ExternKeyword);
+        if (isspace(C)) {
+            ++i;
+            continue;
+        }
+
+        size_t Start = i;
+        if (isalpha(C)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
+            while (i < End && isalnum(Text[i])) {
+                ++i;
+            }
+            Push(KeywordKind(Source.data() + Start, i - Start), Start, 0);
+        } else if (isdigit(C) || C == '.') {   // Number: [0-9.]+
+            while (i < End && (isdigit(Text[i]) || Text[i] == '.')) {
+                ++i;
+            }
+            char Digits[64];
+            size_t Length = min(i - Start, sizeof(Digits) - 1);
+            memcpy(Digits, Source.data() + Start, Length);
+            Digits[Length] = '\0';
+            Push(static_cast<int>(Token::Number), Start, strtod(Digits, nullptr));
+        } else if (C == '#') {
+            // Comment until end of line.
+            while (i < End && Text[i] != '\n' && Text[i] != '\r') {
+                ++i;
+            }
+        } else {
+            // Otherwise, just return the character as its ascii value.
+            ++i;
+            Push(C, Start, 0);
         }
-        return static_cast<int>(Token::Identifier);
     }
+}
+
+void TokenBuffer::compact(size_t Keep) {
+    size_t Base = Keep < Kinds.size() ? Offsets[Keep] : Source.size();
+    Kinds.erase(Kinds.begin(), Kinds.begin() + Keep);
+    Offsets.erase(Offsets.begin(), Offsets.begin() + Keep);
+    Lengths.erase(Lengths.begin(), Lengths.begin() + Keep);
+    Numbers.erase(Numbers.begin(), Numbers.begin() + Keep);
+    for (auto &Offset : Offsets) {
+        Offset -= static_cast<uint32_t>(Base);
+    }
+    Source.erase(0, Base);
+    SourceBase += Base;
+
+    // Keep the start of the line that the first remaining token is on.
+    auto Line = upper_bound(LineStarts.begin(), LineStarts.end(), SourceBase) - 1;
+    LinesDropped += static_cast<unsigned>(Line - LineStarts.begin());
+    LineStarts.erase(LineStarts.begin(), Line);
+}
 
-    if (isdigit(lastChar) || lastChar == '.') {   // Number: [0-9.]+
-        std::string NumStr;
-        do {
-            NumStr += lastChar;
-            lastChar = getchar();
-        } while (isdigit(lastChar) || lastChar == '.');
+void TokenBuffer::clear() {
+    *this = TokenBuffer();
+}
+
+static bool IsInteractive(FILE *In) {
+    // Memory streams have no descriptor, and regular files can be read in one go.
+    struct stat Info;
+    int Descriptor = fileno(In);
+    return Descriptor >= 0 && fstat(Descriptor, &Info) == 0 && !S_ISREG(Info.st_mode);
+}
 
-        NumVal = stod(NumStr, 0);
-        return static_cast<int>(Token::Number);
+//! ReadInput - Append the next chunk of input to the token buffer and lex it. Returns false at the
+//! end of the input.
+static bool ReadInput() {
+    if (Mode == InputMode::Unknown) {
+        Mode = IsInteractive(ReplIn) ? InputMode::Lines : InputMode::Whole;
     }
 
-    if (lastChar == '#') {
-        // Comment until end of line.
-        do {
-            lastChar = getchar();
+    string &Source = Tokens.Source;
+    size_t Start = Source.size();
+    if (Mode == InputMode::Lines) {
+        int C;
+        while ((C = getc(ReplIn)) != EOF) {
+            Source += static_cast<char>(C);
+            if (C == '\n') {
+                break;
+            }
+        }
+    } else {
+        char Chunk[65536];
+        size_t Read;
+        while ((Read = fread(Chunk, 1, sizeof(Chunk), ReplIn)) > 0) {
+            Source.append(Chunk, Read);
         }
-        while (lastChar != EOF && lastChar != '\n' && lastChar != '\r');
-
-        if (lastChar != EOF)
-            return getToken();
     }
 
-    // Check for end of file.  Don't eat the EOF.
-    if (lastChar == EOF) {
-        return static_cast<int>(Token::EndOfFile);
+    if (Source.size() == Start) {
+        return false;
     }
+    Tokens.tokenize(Start);
+    return true;
+}
 
-    // Otherwise, just return the character as its ascii value.
-    int thisChar = lastChar;
-    lastChar = getchar();
-    return thisChar;
+//! FetchToken - The index of the token at Index, lexing more input if needed. Past the end of the
+//! input, this is the index of the EndOfFile token that terminates the buffer.
+static size_t FetchToken(size_t Index) {
+    while (Index >= Tokens.Kinds.size()) {
+        if (!Tokens.Kinds.empty() && Tokens.Kinds.back() == static_cast<int>(Token::EndOfFile)) {
+            return Tokens.Kinds.size() - 1;
+        }
+        if (!ReadInput()) {
+            // Check for end of file.  Don't eat the EOF.
+            Tokens.Kinds.push_back(static_cast<int>(Token::EndOfFile));
+            Tokens.Offsets.push_back(static_cast<uint32_t>(Tokens.Source.size()));
+            Tokens.Lengths.push_back(0);
+            Tokens.Numbers.push_back(0);
+        }
+    }
+    return Index;
 }
 
 int getNextToken() {
-    return CurTok = getToken();
-}
\ No newline at end of file
+    size_t Index = FetchToken(TokPos);
+    TokPos = Index + 1;
+    return CurTok = Tokens.Kinds[Index];
+}
+
+string getTokenText() {
+    if (TokPos == 0) {
+        return "";
+    }
+    return Tokens.Source.substr(Tokens.Offsets[TokPos - 1], Tokens.Lengths[TokPos - 1]);
+}
+
+double getTokenNumber() {
+    return TokPos ? Tokens.Numbers[TokPos - 1] : 0;
+}
+
+SourceLocation getTokenLocation() {
+    uint64_t Offset = Tokens.SourceBase + (TokPos ? Tokens.Offsets[TokPos - 1] : 0);
+    auto Line = upper_bound(Tokens.LineStarts.begin(), Tokens.LineStarts.end(), Offset) - 1;
+
+    SourceLocation Location;
+    Location.Line = Tokens.LinesDropped + static_cast<unsigned>(Line - Tokens.LineStarts.begin()) + 1;
+    Location.Column = static_cast<unsigned>(Offset - *Line) + 1;
+    return Location;
+}
+
+int peekToken(unsigned N) {
+    return Tokens.Kinds[FetchToken(TokPos + N - 1)];
+}
+
+void compactTokens() {
+    size_t Consumed = TokPos ? TokPos - 1 : 0;
+    if (Consumed >= CompactThreshold && Consumed >= Tokens.Kinds.size() - Consumed) {
+        // The current token stays, as the first one in the buffer.
+        Tokens.compact(Consumed);
+        TokPos = 1;
+    }
+}
+
+void ResetLexer() {
+    Tokens.clear();
+    TokPos = 0;
+    CurTok = 0;
+    Mode = InputMode::Unknown;
+}
@@ -8,36 +8,97 @@
 #include "codegen.h"
 #include "jit.h"
 #include "toplevel.h"
+#include "peval.h"
+#include "hashcons.h"
+#include "tiered.h"
+#include "threadpool.h"
+#include "session.h"
+#include "prelude.h"
+#include "server.h"
+#include "jitevents.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "target.h"
 
 //! printd - printf that takes a double prints it as "%f\n", returning 0.
 //! intended to be used as "extern printd(x);"
 extern "C" double printd(double X) {
-    fprintf(stderr, "%f\n", X);
+    fprintf(ReplOut, "%f\n", X);
     return 0;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    string ServerPath;
+    string PreludePath;
+    unsigned ServerThreads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        string Arg = argv[i];
+        if (Arg == "--no-peval") {
+            PartialEvalEnabled = false;
+        } else if (Arg == "--hash-cons") {
+            HashConsEnabled = true;
+        } else if (Arg == "--jit-events") {
+            JITEventsEnabled = true;
+        } else if (Arg == "--pipeline") {
+            PipelineEnabled = true;
+        } else if (Arg == "--profile") {
+            ProfilingEnabled = true;
+        } else if (Arg == "--tiered") {
+            TieredCompilationEnabled = true;
+        } else if (Arg.compare(0, 17, "--tier-threshold=") == 0) {
+            TierUpThreshold = max<uint64_t>(1, strtoull(argv[i] + 17, nullptr, 10));
+        } else if (Arg.compare(0, 10, "--threads=") == 0) {
+            ParallelThreads = static_cast<unsigned>(strtoul(argv[i] + 10, nullptr, 10));
+        } else if (Arg.compare(0, 9, "--server=") == 0) {
+            ServerPath = argv[i] + 9;
+        } else if (Arg.compare(0, 17, "--server-threads=") == 0) {
+            ServerThreads = static_cast<unsigned>(strtoul(argv[i] + 17, nullptr, 10));
+        } else if (Arg.compare(0, 10, "--prelude=") == 0) {
+            PreludePath = argv[i] + 10;
+        } else if (Arg.compare(0, 6, "--cpu=") == 0) {
+            TargetCPU = argv[i] + 6;
+        } else if (Arg.compare(0, 11, "--features=") == 0) {
+            TargetFeatures = argv[i] + 11;
+        } else if (Arg == "--multiversion") {
+            MultiversionEnabled = true;
+        } else if (Arg.compare(0, 11, "--snapshot=") == 0) {
+            SnapshotPath = argv[i] + 11;
+            SnapshotRestoreEnabled = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
     LLVMInitializeNativeTarget();
     LLVMInitializeNativeAsmPrinter();
     LLVMInitializeNativeAsmParser();
 
-    // Install standard binary operators.
-    // 1 is lowest precedence.
-    BinOpPrecedence['<'] = 10;
-    BinOpPrecedence['+'] = 20;
-    BinOpPrecedence['-'] = 20;
-    BinOpPrecedence['*'] = 40;  // highest.
+    InitializeSession();
+    if (!PreludePath.empty() && !LoadPrelude(PreludePath)) {
+        fprintf(stderr, "Cannot read prelude: %s\n", PreludePath.c_str());
+        return 1;
+    }
 
-    // Prime the first token.
-    fprintf(stderr, "ready> ");
-    getNextToken();
+    // The server restores the snapshot into each of its sessions instead.
+    if (!ServerPath.empty()) {
+        return RunServer(ServerPath, ServerThreads);
+    }
+    RestoreSessionSnapshot();
 
-    // prepare the Just-in-Time compiler
-    TheJIT = make_unique<KaleidoscopeJIT>();
-    InitializeModuleAndPassManager();
+    if (PipelineEnabled) {
+        PipelinedMainLoop();
+    } else {
+        // Prime the first token.
+        fprintf(ReplOut, "ready> ");
+        getNextToken();
 
-    // Run the main "interpreter loop" now.
-    MainLoop();
+        // Run the main "interpreter loop" now.
+        MainLoop();
+    }
 
+    ShutdownTieredCompilation();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+//
+// Memoization of pure definitions through JIT-generated result caches.
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <llvm/IR/IRBuilder.h>
+
+#include "memo.h"
+#include "jit.h"
+#include "session.h"
+#include "helper.h"
+
+//! MemoCaches - Owns every cache ever created, keyed by symbol. Caches of superseded definitions
+//! are kept alive until no module in the JIT refers to them anymore.
+static thread_local map<string, unique_ptr<MemoCache>> MemoCaches;
+
+//! CurrentMemoCaches - The cache used by the newest definition of each memoized function.
+//! Caches adopted from the prelude are owned elsewhere.
+static thread_local map<string, MemoCache *> CurrentMemoCaches;
+
+//! MemoGeneration - Numbers the cache symbols, process-wide so that they are unique across sessions.
+static atomic<unsigned> MemoGeneration(0);
+
+MemoCache::MemoCache(const string &Function, const string &Symbol, unsigned Arity)
+        : _function(Function), _symbol(Symbol), _arity(Arity),
+          _words(new uint64_t[HeaderWords + MemoCacheEntries * (Arity + 2)]()) {}
+
+uint64_t MemoCache::getCounter(uint64_t Word) const {
+    return __atomic_load_n(&_words[Word], __ATOMIC_RELAXED);
+}
+
+uint64_t MemoCache::countUsedSlots() const {
+    uint64_t Used = 0;
+    for (uint64_t Slot = 0; Slot < MemoCacheEntries; ++Slot) {
+        if (getCounter(HeaderWords + Slot * getSlotWords()) != 0) {
+            ++Used;
+        }
+    }
+    return Used;
+}
+
+static LoadInst *CreateAtomicLoad(IRBuilder<> &B, Value *Ptr, AtomicOrdering Order, const Twine &Name) {
+    LoadInst *L = B.CreateLoad(Ptr, Name);
+    L->setAtomic(Order);
+    L->setAlignment(8);
+    return L;
+}
+
+static void CreateAtomicStore(IRBuilder<> &B, Value *Val, Value *Ptr, AtomicOrdering Order) {
+    StoreInst *S = B.CreateStore(Val, Ptr);
+    S->setAtomic(Order);
+    S->setAlignment(8);
+}
+
+void EmitMemoWrapper(Function *F, Function *Body) {
+    LLVMContext &Context = F->getContext();
+    Module *M = F->getParent();
+    unsigned Arity = static_cast<unsigned>(F->arg_size());
+
+    string Symbol = "__memo." + F->getName().str() + "." + to_string(++MemoGeneration);
+    auto Cache = helper::make_unique<MemoCache>(F->getName().str(), Symbol, Arity);
+    TheJIT->addRuntimeSymbol(Symbol, Cache->getWords());
+    CurrentMemoCaches[Cache->getFunction()] = Cache.get();
+    MemoCaches[Symbol] = move(Cache);
+
+    Type *Int64Ty = Type::getInt64Ty(Context);
+    Constant *Table = M->getOrInsertGlobal(Symbol, ArrayType::get(Int64Ty, 0));
+
+    BasicBlock *Entry = BasicBlock::Create(Context, "entry", F);
+    BasicBlock *Hit = BasicBlock::Create(Context, "hit", F);
+    BasicBlock *Miss = BasicBlock::Create(Context, "miss", F);
+    BasicBlock *Lock = BasicBlock::Create(Context, "lock", F);
+    BasicBlock *Store = BasicBlock::Create(Context, "store", F);
+    BasicBlock *Done = BasicBlock::Create(Context, "done", F);
+    IRBuilder<> B(Entry);
+
+    auto WordPtr = [&](Value *Index) -> Value * {
+        Value *Indices[] = {B.getInt64(0), Index};
+        return B.CreateGEP(Table, Indices);
+    };
+
+    // Hash the argument bit patterns and pick the slot.
+    vector<Value *> Keys;
+    Value *Hash = B.getInt64(0xcbf29ce484222325ULL);
+    for (auto &Arg : F->args()) {
+        Value *Bits = B.CreateBitCast(&Arg, Int64Ty, "argbits");
+        Keys.push_back(Bits);
+        Hash = B.CreateMul(B.CreateXor(Hash, Bits), B.getInt64(0x9e3779b97f4a7c15ULL), "hash");
+    }
+    Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33));
+    Hash = B.CreateMul(Hash, B.getInt64(0xff51afd7ed558ccdULL));
+    Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33));
+    Hash = B.CreateMul(Hash, B.getInt64(0xc4ceb9fe1a85ec53ULL));
+    Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33), "hash");
+
+    Value *Slot = B.CreateAnd(Hash, B.getInt64(MemoCacheEntries - 1), "slot");
+    Value *Base = B.CreateAdd(B.CreateMul(Slot, B.getInt64(Arity + 2)),
+                              B.getInt64(MemoCache::HeaderWords), "base");
+    Value *SeqPtr = WordPtr(Base);
+    Value *ResultPtr = WordPtr(B.CreateAdd(Base, B.getInt64(Arity + 1)));
+
+    // Seqlock-style read: the entry is only used if its sequence number was even and non-zero
+    // before reading the keys and did not change afterwards.
+    Value *Seq = CreateAtomicLoad(B, SeqPtr, AtomicOrdering::Acquire, "seq");
+    Value *Even = B.CreateICmpEQ(B.CreateAnd(Seq, B.getInt64(1)), B.getInt64(0), "even");
+    Value *Match = B.CreateAnd(Even, B.CreateICmpNE(Seq, B.getInt64(0)));
+    for (unsigned i = 0; i != Arity; ++i) {
+        Value *Key = CreateAtomicLoad(B, WordPtr(B.CreateAdd(Base, B.getInt64(i + 1))),
+                                      AtomicOrdering::Monotonic, "key");
+        Match = B.CreateAnd(Match, B.CreateICmpEQ(Key, Keys[i]));
+    }
+    Value *Cached = CreateAtomicLoad(B, ResultPtr, AtomicOrdering::Monotonic, "cached");
+    B.CreateFence(AtomicOrdering::Acquire);
+    Value *SeqAfter = CreateAtomicLoad(B, SeqPtr, AtomicOrdering::Monotonic, "seqafter");
+    Match = B.CreateAnd(Match, B.CreateICmpEQ(Seq, SeqAfter), "match");
+    B.CreateCondBr(Match, Hit, Miss);
+
+    // Cache hit: return the stored result.
+    B.SetInsertPoint(Hit);
+    B.CreateAtomicRMW(AtomicRMWInst::Add, WordPtr(B.getInt64(MemoCache::HitsWord)), B.getInt64(1),
+                      AtomicOrdering::Monotonic);
+    B.CreateRet(B.CreateBitCast(Cached, F->getReturnType()));
+
+    // Cache miss: compute the result, then try to claim the slot. If another thread is writing
+    // the same slot, the result is simply not cached.
+    B.SetInsertPoint(Miss);
+    B.CreateAtomicRMW(AtomicRMWInst::Add, WordPtr(B.getInt64(MemoCache::MissesWord)), B.getInt64(1),
+                      AtomicOrdering::Monotonic);
+    vector<Value *> Args;
+    for (auto &Arg : F->args()) {
+        Args.push_back(&Arg);
+    }
+    Value *Result = B.CreateCall(Body, Args, "result");
+    B.CreateCondBr(Even, Lock, Done);
+
+    B.SetInsertPoint(Lock);
+    Value *Claim = B.CreateAtomicCmpXchg(SeqPtr, Seq, B.CreateAdd(Seq, B.getInt64(1)),
+                                         AtomicOrdering::Acquire, AtomicOrdering::Monotonic);
+    B.CreateCondBr(B.CreateExtractValue(Claim, 1, "claimed"), Store, Done);
+
+    B.SetInsertPoint(Store);
+    for (unsigned i = 0; i != Arity; ++i) {
+        CreateAtomicStore(B, Keys[i], WordPtr(B.CreateAdd(Base, B.getInt64(i + 1))), AtomicOrdering::Monotonic);
+    }
+    CreateAtomicStore(B, B.CreateBitCast(Result, Int64Ty), ResultPtr, AtomicOrdering::Monotonic);
+    CreateAtomicStore(B, B.CreateAdd(Seq, B.getInt64(2)), SeqPtr, AtomicOrdering::Release);
+    B.CreateAtomicRMW(AtomicRMWInst::Add, WordPtr(B.getInt64(MemoCache::EvictionsWord)),
+                      B.CreateZExt(B.CreateICmpNE(Seq, B.getInt64(0)), Int64Ty),
+                      AtomicOrdering::Monotonic);
+    B.CreateBr(Done);
+
+    B.SetInsertPoint(Done);
+    B.CreateRet(Result);
+}
+
+MemoCache *GetMemoCache(const string &Function) {
+    auto Current = CurrentMemoCaches.find(Function);
+    return Current != CurrentMemoCaches.end() ? Current->second : nullptr;
+}
+
+void SetCurrentMemoCache(const string &Function, MemoCache *Cache) {
+    if (Cache) {
+        CurrentMemoCaches[Function] = Cache;
+    } else {
+        CurrentMemoCaches.erase(Function);
+    }
+}
+
+void AdoptMemoCache(MemoCache &Cache) {
+    TheJIT->addRuntimeSymbol(Cache.getSymbol(), Cache.getWords());
+    CurrentMemoCaches[Cache.getFunction()] = &Cache;
+}
+
+vector<MemoCache *> GetMemoCaches() {
+    vector<MemoCache *> Caches;
+    for (auto &Entry : MemoCaches) {
+        Caches.push_back(Entry.second.get());
+    }
+    for (auto &Entry : CurrentMemoCaches) {
+        if (!MemoCaches.count(Entry.second->getSymbol())) {
+            Caches.push_back(Entry.second);
+        }
+    }
+    return Caches;
+}
+
+MemoCache &RestoreMemoCache(const string &Function, const string &Symbol, unsigned Arity, bool Current) {
+    // Caches created from now on must not reuse the symbol, which ends in its generation.
+    unsigned Generation = static_cast<unsigned>(strtoul(Symbol.c_str() + Symbol.rfind('.') + 1, nullptr, 10));
+    unsigned Newest = MemoGeneration;
+    while (Newest < Generation && !MemoGeneration.compare_exchange_weak(Newest, Generation)) {
+    }
+
+    auto Cache = helper::make_unique<MemoCache>(Function, Symbol, Arity);
+    TheJIT->addRuntimeSymbol(Symbol, Cache->getWords());
+    if (Current) {
+        CurrentMemoCaches[Function] = Cache.get();
+    }
+    MemoCache &Result = *Cache;
+    MemoCaches[Symbol] = move(Cache);
+    return Result;
+}
+
+unsigned CollectMemoCaches(uint64_t &Bytes) {
+    unsigned Collected = 0;
+    for (auto Entry = MemoCaches.begin(); Entry != MemoCaches.end();) {
+        MemoCache &Cache = *Entry->second;
+        if (GetMemoCache(Cache.getFunction()) == &Cache || TheJIT->isSymbolReferenced(Entry->first)) {
+            ++Entry;
+            continue;
+        }
+        TheJIT->removeRuntimeSymbol(Entry->first);
+        Bytes += Cache.getBytes();
+        ++Collected;
+        Entry = MemoCaches.erase(Entry);
+    }
+    return Collected;
+}
+
+void GetMemoCacheUsage(size_t &Caches, uint64_t &Bytes) {
+    Caches = MemoCaches.size();
+    Bytes = 0;
+    for (auto &Entry : MemoCaches) {
+        Bytes += Entry.second->getBytes();
+    }
+}
+
+void ResetMemoCaches() {
+    CurrentMemoCaches.clear();
+    MemoCaches.clear();
+}
+
+void PrintMemoStats() {
+    if (CurrentMemoCaches.empty()) {
+        fprintf(ReplOut, "No memoized functions.\n");
+        return;
+    }
+
+    for (auto &Entry : CurrentMemoCaches) {
+        MemoCache &Cache = *Entry.second;
+        uint64_t Hits = Cache.getCounter(MemoCache::HitsWord);
+        uint64_t Misses = Cache.getCounter(MemoCache::MissesWord);
+        uint64_t Calls = Hits + Misses;
+        double HitRate = Calls ? 100.0 * Hits / Calls : 0.0;
+
+        fprintf(ReplOut, "memo %s: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions, %llu/%llu slots used\n",
+                Entry.first.c_str(),
+                (unsigned long long) Hits,
+                (unsigned long long) Misses,
+                HitRate,
+                (unsigned long long) Cache.getCounter(MemoCache::EvictionsWord),
+                (unsigned long long) Cache.countUsedSlots(),
+                (unsigned long long) MemoCacheEntries);
+    }
+}
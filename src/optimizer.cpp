@@ -15,12 +15,13 @@
 
 using namespace helper;
 
-unique_ptr<legacy::FunctionPassManager> TheFPM;
+thread_local unique_ptr<legacy::FunctionPassManager> TheFPM;
 
 void InitializeModuleAndPassManager(void) {
     // Open a new module.
     TheModule = helper::make_unique<Module>("Kaleidoscope Tutorial JIT", TheContext);
     TheModule->setDataLayout(TheJIT->getTargetMachine().createDataLayout());
+    TheModule->setTargetTriple(TheJIT->getTargetMachine().getTargetTriple().str());
 
     // Create a new pass manager attached to it.
     TheFPM = helper::make_unique<legacy::FunctionPassManager>(TheModule.get());
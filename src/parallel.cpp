@@ -0,0 +1,126 @@
+//
+// Parallel map/reduce builtins.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+#include "codegen.h"
+#include "jit.h"
+#include "threadpool.h"
+#include "tiered.h"
+
+typedef double (*MapFn)(double);
+typedef double (*ReduceFn)(double, double);
+
+//! MaxIndex - The largest magnitude of an index. Every integer up to it is exact as a double, and no range
+//! between -MaxIndex and MaxIndex overflows int64_t.
+static const double MaxIndex = 9007199254740992.0;
+
+//! ToIndex - The first integer at or above the bound X, clamped to [-MaxIndex, MaxIndex]. X must not be NaN.
+static int64_t ToIndex(double X) {
+    return (int64_t) ceil(max(-MaxIndex, min(MaxIndex, X)));
+}
+
+extern "C" double chickadee_parsum(void *F, double Lo, double Hi) {
+    // A NaN bound makes the range empty, like the comparison lo <= i < hi would.
+    if (isnan(Lo) || isnan(Hi)) {
+        return 0;
+    }
+    MapFn Map = (MapFn) F;
+    return GetThreadPool().parallelReduce(
+            ToIndex(Lo), ToIndex(Hi),
+            [Map](int64_t Begin, int64_t End) {
+                double Sum = 0;
+                for (int64_t i = Begin; i < End; ++i) {
+                    Sum += Map((double) i);
+                }
+                return Sum;
+            },
+            [](double A, double B) { return A + B; });
+}
+
+extern "C" double chickadee_parmap(void *F, void *G, double Lo, double Hi) {
+    if (isnan(Lo) || isnan(Hi)) {
+        return 0;
+    }
+    MapFn Map = (MapFn) F;
+    ReduceFn Reduce = (ReduceFn) G;
+    return GetThreadPool().parallelReduce(
+            ToIndex(Lo), ToIndex(Hi),
+            [Map, Reduce](int64_t Begin, int64_t End) {
+                double Result = Map((double) Begin);
+                for (int64_t i = Begin + 1; i < End; ++i) {
+                    Result = Reduce(Result, Map((double) i));
+                }
+                return Result;
+            },
+            Reduce);
+}
+
+bool isParallelBuiltin(const string &Name) {
+    return (Name == "parsum" || Name == "parmap") && !FunctionProtos.count(Name);
+}
+
+unsigned getFunctionArgumentCount(const string &Builtin) {
+    return Builtin == "parmap" ? 2 : 1;
+}
+
+//! EmitFunctionPointer - The address to call the named function at. Tiered functions are called
+//! through their slot, so that the pool picks up optimized code.
+static Value *EmitFunctionPointer(IRBuilder<> &Builder, const string &Name, Function *F) {
+    if (TierSlot *Slot = FindTierSlot(Name)) {
+        return EmitSlotTarget(Builder, *Slot);
+    }
+    return Builder.CreateBitCast(F, Builder.getInt8PtrTy());
+}
+
+void DeclareParallelRuntime() {
+    TheJIT->addRuntimeSymbol("chickadee_parsum", (void *) &chickadee_parsum);
+    TheJIT->addRuntimeSymbol("chickadee_parmap", (void *) &chickadee_parmap);
+}
+
+Value *EmitParallelBuiltin(IRBuilder<> &Builder, const CallExprAST &Call) {
+    auto &Args = Call.getArgs();
+    unsigned FunctionArgs = getFunctionArgumentCount(Call.getCallee());
+    if (Args.size() != FunctionArgs + 2) {
+        return LogErrorV("Incorrect # arguments passed");
+    }
+
+    vector<Value *> ArgsV;
+    for (unsigned i = 0; i != FunctionArgs; ++i) {
+        auto *Ref = dyn_cast<VariableExprAST>(Args[i].get());
+        if (!Ref) {
+            return LogErrorV("Expected a function name");
+        }
+
+        // The mapped function takes the index, the reducing function two partial results.
+        Function *F = getFunction(Ref->getName());
+        unsigned Arity = i == 0 ? 1 : 2;
+        vector<Type *> Doubles(Arity, Builder.getDoubleTy());
+        if (!F || F->getFunctionType() != FunctionType::get(Builder.getDoubleTy(), Doubles, false)) {
+            return LogErrorV(Arity == 1 ? "Expected a function of one double"
+                                        : "Expected a function of two doubles");
+        }
+        ArgsV.push_back(EmitFunctionPointer(Builder, Ref->getName(), F));
+    }
+
+    for (unsigned i = FunctionArgs; i != Args.size(); ++i) {
+        ArgsV.push_back(Args[i]->codegen());
+        if (!ArgsV.back()) {
+            return nullptr;
+        }
+    }
+
+    vector<Type *> Types;
+    for (auto *V : ArgsV) {
+        Types.push_back(V->getType());
+    }
+    FunctionType *FT = FunctionType::get(Builder.getDoubleTy(), Types, false);
+
+    string Runtime = "chickadee_" + Call.getCallee();
+    DeclareParallelRuntime();
+    Module *M = Builder.GetInsertBlock()->getModule();
+    return Builder.CreateCall(M->getOrInsertFunction(Runtime, FT), ArgsV, "partmp");
+}
@@ -5,24 +5,33 @@
 #include "ast.h"
 #include "lexer.h"
 #include "parser.h"
+#include "session.h"
+#include "simd.h"
 
 #include "helper.h"
 using namespace helper;
 
 //! LogError* - These are little helper functions for error handling.
 unique_ptr<ExprAST> LogError(const char *Str) {
-    fprintf(stderr, "LogError: %s\n", Str);
+    fprintf(ReplOut, "LogError: %s\n", Str);
+    return nullptr;
+}
+
+//! LogParseError - Report a syntax error at the current token.
+unique_ptr<ExprAST> LogParseError(const char *Str) {
+    SourceLocation Location = getTokenLocation();
+    fprintf(ReplOut, "LogError: %u:%u: %s\n", Location.Line, Location.Column, Str);
     return nullptr;
 }
 
 unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
-    LogError(Str);
+    LogParseError(Str);
     return nullptr;
 }
 
 //! numberexpr ::= number
 unique_ptr<ExprAST> ParseNumberExpr() {
-    auto Result = make_unique<NumberExprAST>(NumVal);
+    auto Result = make_unique<NumberExprAST>(getTokenNumber());
     getNextToken(); // consume the number
     return Result;
 }
@@ -35,7 +44,7 @@ unique_ptr<ExprAST> ParseParenExpr() {
         return nullptr;
 
     if (CurTok != ')') {
-        return LogError("expected ')'");
+        return LogParseError("expected ')'");
     }
     getNextToken(); // eat ).
     return V;
@@ -45,7 +54,7 @@ unique_ptr<ExprAST> ParseParenExpr() {
 //!   ::= identifier
 //!   ::= identifier '(' expression* ')'
 unique_ptr<ExprAST> ParseIdentifierExpr() {
-    string IdName = IdentifierStr;
+    string IdName = getTokenText();
 
     getNextToken();  // eat identifier.
 
@@ -70,7 +79,7 @@ unique_ptr<ExprAST> ParseIdentifierExpr() {
             }
 
             if (CurTok != ',') {
-                return LogError("Expected ')' or ',' in argument list");
+                return LogParseError("Expected ')' or ',' in argument list");
             }
             getNextToken();
         }
@@ -89,7 +98,7 @@ unique_ptr<ExprAST> ParseIdentifierExpr() {
 unique_ptr<ExprAST> ParsePrimary() {
     switch (CurTok) {
         default:
-            return LogError("unknown token when expecting an expression");
+            return LogParseError("unknown token when expecting an expression");
         case static_cast<int>(Token::Identifier):
             return ParseIdentifierExpr();
         case static_cast<int>(Token::Number):
@@ -101,7 +110,7 @@ unique_ptr<ExprAST> ParsePrimary() {
 
 /// BinOpPrecedence - This holds the precedence for each binary operator that is
 /// defined.
-map<char, int> BinOpPrecedence;
+thread_local map<char, int> BinOpPrecedence;
 
 //! GetTokPrecedence - Get the precedence of the pending binary operator token.
 int GetTokPrecedence() {
@@ -170,23 +179,31 @@ unique_ptr<ExprAST> ParseBinOpRHS(int expressionPrecedence, unique_ptr<ExprAST>
 }
 
 //! prototype
-//!   ::= id '(' id* ')'
+//!   ::= id '(' (id (':' type)?)* ')'
 unique_ptr<PrototypeAST> ParsePrototype() {
     if (CurTok != static_cast<int>(Token::Identifier)) {
         return LogErrorP("Expected function name in prototype");
     }
 
-    std::string FnName = IdentifierStr;
+    std::string FnName = getTokenText();
     getNextToken();
 
     if (CurTok != '(') {
         return LogErrorP("Expected '(' in prototype");
     }
 
-    // Read the list of argument names.
+    // Read the list of argument names and their optional type annotations.
     std::vector<std::string> ArgNames;
+    std::vector<ValueType> ArgTypes;
     while (getNextToken() == static_cast<int>(Token::Identifier)) {
-        ArgNames.push_back(IdentifierStr);
+        ArgNames.push_back(getTokenText());
+        ArgTypes.push_back(ValueType::Double);
+        if (peekToken() == ':') {
+            getNextToken();  // eat the argument name.
+            if (getNextToken() != static_cast<int>(Token::Identifier) || !ParseValueType(getTokenText(), ArgTypes.back())) {
+                return LogErrorP("Expected vec2, vec4 or double after ':' in prototype");
+            }
+        }
     }
 
     if (CurTok != ')') {
@@ -196,17 +213,27 @@ unique_ptr<PrototypeAST> ParsePrototype() {
     // success.
     getNextToken();  // eat ')'.
 
-    return make_unique<PrototypeAST>(FnName, std::move(ArgNames));
+    return make_unique<PrototypeAST>(FnName, std::move(ArgNames), std::move(ArgTypes));
 }
 
-//! definition ::= 'def' prototype expression
+//! definition ::= 'def' 'memo'? prototype expression
+//! memo is only a keyword right in front of the name of the function, so that it stays usable as a name
+//! everywhere else, e.g. in "def memo(x) ..." or in the ":memo" command.
 unique_ptr<FunctionAST> ParseDefinition() {
     getNextToken();  // eat def.
+
+    bool IsMemo = false;
+    if (CurTok == static_cast<int>(Token::Identifier) && getTokenText() == "memo"
+        && peekToken() == static_cast<int>(Token::Identifier)) {
+        IsMemo = true;
+        getNextToken();  // eat memo.
+    }
+
     auto Proto = ParsePrototype();
     if (!Proto) return nullptr;
 
     if (auto E = ParseExpression()) {
-        return make_unique<FunctionAST>(move(Proto), move(E));
+        return make_unique<FunctionAST>(move(Proto), move(E), IsMemo);
     }
     return nullptr;
 }
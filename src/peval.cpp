@@ -0,0 +1,330 @@
+//
+// AST-level partial evaluation ahead of code generation.
+//
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <cstring>
+
+#include "peval.h"
+#include "analysis.h"
+#include "codegen.h"
+#include "optimizer.h"
+#include "jit.h"
+#include "depgraph.h"
+#include "session.h"
+#include "helper.h"
+
+bool PartialEvalEnabled = true;
+
+//! Specializations - Maps a call signature such as "f(3,_)" to the name of the specialized clone.
+static thread_local map<string, string> Specializations;
+
+//! SpecializationCounter - Numbers the clones, process-wide so that clones in the shared prelude
+//! never clash with the ones a session creates.
+static atomic<unsigned> SpecializationCounter(0);
+
+//! PartialEvalStats - Counters reported by the :peval command.
+struct PartialEvalStats {
+    unsigned long Evaluations = 0;
+    unsigned long FoldedOperators = 0;
+    unsigned long FoldedCalls = 0;
+    unsigned long FoldedThroughClones = 0;
+    unsigned long UnfoldedCalls = 0;
+    unsigned long SpecializationsCreated = 0;
+    unsigned long SpecializationsReused = 0;
+    double EvaluationSeconds = 0;
+    double FoldedCallSeconds = 0;
+};
+
+static thread_local PartialEvalStats Stats;
+
+//! PartialEvalContext - The state threaded through one partial evaluation.
+struct PartialEvalContext {
+    //! The functions being compiled; their previous definitions must not be used for folding.
+    set<string> Stale;
+    //! Parameters that are bound to constants in a specialized body.
+    map<string, double> Bindings;
+    unsigned Depth;
+};
+
+static unique_ptr<ExprAST> Evaluate(const ExprAST &E, const PartialEvalContext &Ctx);
+
+//! MaxEvaluatedArgs - The most arguments that EvaluateCall can pass to a compiled function.
+static const size_t MaxEvaluatedArgs = 4;
+
+//! EvaluateCall - Call the compiled function Callee with constant arguments.
+static bool EvaluateCall(const string &Callee, const vector<double> &Args, double &Result) {
+    auto Symbol = TheJIT->findSymbol(Callee);
+    if (!Symbol) {
+        return false;
+    }
+
+    intptr_t Address = (intptr_t) Symbol.getAddress();
+    switch (Args.size()) {
+        case 0: Result = ((double (*)()) Address)(); return true;
+        case 1: Result = ((double (*)(double)) Address)(Args[0]); return true;
+        case 2: Result = ((double (*)(double, double)) Address)(Args[0], Args[1]); return true;
+        case 3: Result = ((double (*)(double, double, double)) Address)(Args[0], Args[1], Args[2]); return true;
+        case 4:
+            Result = ((double (*)(double, double, double, double)) Address)(Args[0], Args[1], Args[2], Args[3]);
+            return true;
+        default:
+            return false;
+    }
+}
+
+//! CallSignature - Build the specialization cache key, e.g. "f(0x4008000000000000,_)".
+static string CallSignature(const string &Callee, const vector<unique_ptr<ExprAST>> &Args) {
+    string Signature = Callee + "(";
+    for (size_t i = 0; i != Args.size(); ++i) {
+        if (i) {
+            Signature += ",";
+        }
+        if (auto *N = dyn_cast<NumberExprAST>(Args[i].get())) {
+            uint64_t Bits;
+            double Value = N->getValue();
+            memcpy(&Bits, &Value, sizeof(Bits));
+            char Buffer[24];
+            snprintf(Buffer, sizeof(Buffer), "%llx", (unsigned long long) Bits);
+            Signature += Buffer;
+        } else {
+            Signature += "_";
+        }
+    }
+    return Signature + ")";
+}
+
+//! CompileSpecialization - Compile a specialized clone into a module of its own, so that it
+//! outlives the module of the expression that first needed it.
+static bool CompileSpecialization(FunctionAST &Spec) {
+    auto SavedModule = move(TheModule);
+    auto SavedFPM = move(TheFPM);
+    InitializeModuleAndPassManager();
+
+    bool Compiled = Spec.codegen() != nullptr;
+    if (Compiled) {
+        TheJIT->addModule(move(TheModule));
+    }
+
+    TheModule = move(SavedModule);
+    TheFPM = move(SavedFPM);
+    return Compiled;
+}
+
+//! Specialize - Return the name of a clone of Callee specialized on its constant arguments.
+static string Specialize(const FunctionAST &Callee, const vector<unique_ptr<ExprAST>> &Args,
+                         const PartialEvalContext &Ctx) {
+    string Signature = CallSignature(Callee.getProto().getName(), Args);
+    auto Cached = Specializations.find(Signature);
+    if (Cached != Specializations.end()) {
+        ++Stats.SpecializationsReused;
+        return Cached->second;
+    }
+
+    PartialEvalContext SpecCtx;
+    SpecCtx.Stale = Ctx.Stale;
+    SpecCtx.Depth = Ctx.Depth + 1;
+
+    vector<string> Params;
+    auto &CalleeParams = Callee.getProto().getArgs();
+    for (size_t i = 0; i != Args.size(); ++i) {
+        if (auto *N = dyn_cast<NumberExprAST>(Args[i].get())) {
+            SpecCtx.Bindings[CalleeParams[i]] = N->getValue();
+        } else {
+            Params.push_back(CalleeParams[i]);
+        }
+    }
+
+    string Name = Callee.getProto().getName() + ".spec" + to_string(++SpecializationCounter);
+    auto Proto = helper::make_unique<PrototypeAST>(Name, move(Params));
+    FunctionAST Spec(move(Proto), Evaluate(Callee.getBody(), SpecCtx));
+    if (!CompileSpecialization(Spec)) {
+        return "";
+    }
+
+    ++Stats.SpecializationsCreated;
+    Specializations[Signature] = Name;
+    return Name;
+}
+
+static unique_ptr<ExprAST> EvaluateBinary(const BinaryExprAST &B, const PartialEvalContext &Ctx) {
+    auto LHS = Evaluate(B.getLHS(), Ctx);
+    auto RHS = Evaluate(B.getRHS(), Ctx);
+
+    auto *L = dyn_cast<NumberExprAST>(LHS.get());
+    auto *R = dyn_cast<NumberExprAST>(RHS.get());
+    if (L && R) {
+        double LV = L->getValue(), RV = R->getValue();
+        switch (B.getOp()) {
+            case '+': ++Stats.FoldedOperators; return helper::make_unique<NumberExprAST>(LV + RV);
+            case '-': ++Stats.FoldedOperators; return helper::make_unique<NumberExprAST>(LV - RV);
+            case '*': ++Stats.FoldedOperators; return helper::make_unique<NumberExprAST>(LV * RV);
+            // Same semantics as the unordered comparison emitted by codegen: true if either side is NaN.
+            case '<': ++Stats.FoldedOperators; return helper::make_unique<NumberExprAST>(!(LV >= RV) ? 1.0 : 0.0);
+            default: break;
+        }
+    }
+    return helper::make_unique<BinaryExprAST>(B.getOp(), move(LHS), move(RHS));
+}
+
+static unique_ptr<ExprAST> EvaluateCallExpr(const CallExprAST &C, const PartialEvalContext &Ctx) {
+    vector<unique_ptr<ExprAST>> Args;
+    vector<double> Constants;
+    for (auto &Arg : C.getArgs()) {
+        Args.push_back(Evaluate(*Arg, Ctx));
+        if (auto *N = dyn_cast<NumberExprAST>(Args.back().get())) {
+            Constants.push_back(N->getValue());
+        }
+    }
+
+    // Only already compiled, pure definitions of doubles can be evaluated or specialized. The functions
+    // that are being compiled right now are excluded, since the JIT still holds their previous definitions.
+    auto Def = FunctionDefs.find(C.getCallee());
+    auto Proto = FunctionProtos.find(C.getCallee());
+    bool Eligible = Def != FunctionDefs.end() && !Ctx.Stale.count(C.getCallee()) && PureFunctions.count(C.getCallee())
+                    && Def->second->getProto().getArgs().size() == Args.size()
+                    && Proto != FunctionProtos.end() && Proto->second->isScalar();
+    if (!Eligible || Constants.empty()) {
+        return helper::make_unique<CallExprAST>(C.getCallee(), move(Args));
+    }
+
+    if (Constants.size() == Args.size()) {
+        // Calls of more arguments than EvaluateCall can pass are folded by calling a clone that is
+        // specialized on all of them, and so takes none.
+        string Target = C.getCallee();
+        if (Constants.size() > MaxEvaluatedArgs) {
+            Target = Ctx.Depth < MaxSpecializationDepth ? Specialize(*Def->second, Args, Ctx) : "";
+            Constants.clear();
+        }
+
+        double Result;
+        auto Start = chrono::steady_clock::now();
+        if (!Target.empty() && EvaluateCall(Target, Constants, Result)) {
+            Stats.FoldedCallSeconds += chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+            ++Stats.FoldedCalls;
+            if (Target != C.getCallee()) {
+                ++Stats.FoldedThroughClones;
+            }
+            return helper::make_unique<NumberExprAST>(Result);
+        }
+        ++Stats.UnfoldedCalls;
+    } else if (Ctx.Depth < MaxSpecializationDepth) {
+        string Name = Specialize(*Def->second, Args, Ctx);
+        if (!Name.empty()) {
+            vector<unique_ptr<ExprAST>> Remaining;
+            for (auto &Arg : Args) {
+                if (!isa<NumberExprAST>(Arg.get())) {
+                    Remaining.push_back(move(Arg));
+                }
+            }
+            return helper::make_unique<CallExprAST>(Name, move(Remaining));
+        }
+    }
+
+    return helper::make_unique<CallExprAST>(C.getCallee(), move(Args));
+}
+
+static unique_ptr<ExprAST> Evaluate(const ExprAST &E, const PartialEvalContext &Ctx) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            return helper::make_unique<NumberExprAST>(cast<NumberExprAST>(E).getValue());
+        }
+        case ExprAST::EK_Variable: {
+            auto &Name = cast<VariableExprAST>(E).getName();
+            auto Binding = Ctx.Bindings.find(Name);
+            if (Binding != Ctx.Bindings.end()) {
+                return helper::make_unique<NumberExprAST>(Binding->second);
+            }
+            return helper::make_unique<VariableExprAST>(Name);
+        }
+        case ExprAST::EK_Binary: {
+            return EvaluateBinary(cast<BinaryExprAST>(E), Ctx);
+        }
+        case ExprAST::EK_Call: {
+            return EvaluateCallExpr(cast<CallExprAST>(E), Ctx);
+        }
+        case ExprAST::EK_Shared: {
+            return Evaluate(cast<SharedExprAST>(E).getExpr(), Ctx);
+        }
+    }
+    return nullptr;
+}
+
+unique_ptr<ExprAST> PartiallyEvaluate(const ExprAST &E, const set<string> &Stale) {
+    PartialEvalContext Ctx;
+    Ctx.Stale = Stale;
+    Ctx.Depth = 0;
+
+    auto Start = chrono::steady_clock::now();
+    auto Result = Evaluate(E, Ctx);
+    Stats.EvaluationSeconds += chrono::duration<double>(chrono::steady_clock::now() - Start).count();
+    ++Stats.Evaluations;
+    return Result;
+}
+
+unique_ptr<FunctionAST> PartiallyEvaluate(const FunctionAST &FnAST, const set<string> &Stale) {
+    if (!PartialEvalEnabled) {
+        return nullptr;
+    }
+
+    auto &Proto = FnAST.getProto();
+    set<string> StaleOrSelf(Stale);
+    StaleOrSelf.insert(Proto.getName());
+    return helper::make_unique<FunctionAST>(helper::make_unique<PrototypeAST>(Proto),
+                                            PartiallyEvaluate(FnAST.getBody(), StaleOrSelf),
+                                            FnAST.isMemo());
+}
+
+unsigned GetSpecializationCount() {
+    return SpecializationCounter;
+}
+
+void ReserveSpecializations(unsigned Count) {
+    unsigned Current = SpecializationCounter;
+    while (Current < Count && !SpecializationCounter.compare_exchange_weak(Current, Count)) {
+    }
+}
+
+void InvalidateSpecializations(const string &Name) {
+    set<string> Changed = GetDependents(Name);
+    Changed.insert(Name);
+    for (auto Spec = Specializations.begin(); Spec != Specializations.end();) {
+        if (Changed.count(Spec->first.substr(0, Spec->first.find('(')))) {
+            Spec = Specializations.erase(Spec);
+        } else {
+            ++Spec;
+        }
+    }
+}
+
+void CollectSpecializations() {
+    for (auto Spec = Specializations.begin(); Spec != Specializations.end();) {
+        if (TheJIT->isSymbolDefined(Spec->second)) {
+            ++Spec;
+        } else {
+            Spec = Specializations.erase(Spec);
+        }
+    }
+}
+
+void ResetPartialEvaluation() {
+    Specializations.clear();
+    Stats = PartialEvalStats();
+}
+
+void PrintPartialEvalStats() {
+    fprintf(ReplOut, "partial evaluation %s: %lu items in %.3f ms (%.1f us/item)\n",
+            PartialEvalEnabled ? "enabled" : "disabled",
+            Stats.Evaluations,
+            Stats.EvaluationSeconds * 1e3,
+            Stats.Evaluations ? Stats.EvaluationSeconds * 1e6 / Stats.Evaluations : 0.0);
+    fprintf(ReplOut, "  folded %lu operators and %lu calls; the folded calls took %.3f ms to run, "
+                    "which is no longer paid at run time\n",
+            Stats.FoldedOperators, Stats.FoldedCalls, Stats.FoldedCallSeconds * 1e3);
+    fprintf(ReplOut, "  %lu calls of more than %lu arguments folded through a specialization, %lu calls not folded\n",
+            Stats.FoldedThroughClones, (unsigned long) MaxEvaluatedArgs, Stats.UnfoldedCalls);
+    fprintf(ReplOut, "  %lu specializations created, %lu reused from cache\n",
+            Stats.SpecializationsCreated, Stats.SpecializationsReused);
+}
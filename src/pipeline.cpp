@@ -0,0 +1,208 @@
+//
+// A pipelined main loop that parses ahead while earlier items are compiled and run.
+//
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "pipeline.h"
+#include "lexer.h"
+#include "parser.h"
+#include "toplevel.h"
+#include "tiered.h"
+#include "session.h"
+
+bool PipelineEnabled = false;
+
+//! PipelineDepth - How many parsed items the producer may run ahead of the compiler.
+static const size_t PipelineDepth = 64;
+
+//! ParsedItem - One iteration of the main loop, parsed but not yet compiled. Items that were a ';'
+//! or failed to parse carry nothing but their diagnostics.
+struct ParsedItem {
+    enum ItemKind {
+        Empty,
+        Definition,
+        Extern,
+        Expression,
+        Command,
+        EndOfFile,
+    };
+
+    ItemKind Kind = Empty;
+    unique_ptr<FunctionAST> Function;
+    unique_ptr<PrototypeAST> Proto;
+    string CommandName;
+
+    //! What parsing the item printed, to be printed once the items before it have run.
+    string Diagnostics;
+};
+
+//! ItemQueue - The bounded queue between the parser and the compiler. A full queue only takes items
+//! again once it has drained to half, so that the threads do not hand over control for every item.
+class ItemQueue {
+public:
+    void push(ParsedItem Item) {
+        unique_lock<mutex> Lock(Mutex);
+        NotFull.wait(Lock, [this] { return Items.size() < PipelineDepth; });
+        Items.push_back(move(Item));
+        if (Items.size() == 1) {
+            NotEmpty.notify_one();
+        }
+    }
+
+    ParsedItem pop() {
+        unique_lock<mutex> Lock(Mutex);
+        NotEmpty.wait(Lock, [this] { return !Items.empty(); });
+        ParsedItem Item = move(Items.front());
+        Items.pop_front();
+        if (Items.size() == PipelineDepth / 2) {
+            NotFull.notify_one();
+        }
+        return Item;
+    }
+
+private:
+    mutex Mutex;
+    condition_variable NotEmpty;
+    condition_variable NotFull;
+    deque<ParsedItem> Items;
+};
+
+//! ParseItem - Parse the item at CurTok, the same way MainLoop would.
+static ParsedItem ParseItem() {
+    ParsedItem Item;
+    switch (CurTok) {
+        case static_cast<int>(Token::EndOfFile): {
+            Item.Kind = ParsedItem::EndOfFile;
+            break;
+        }
+        case ';': { // ignore top-level semicolons.
+            getNextToken();
+            break;
+        }
+        case static_cast<int>(Token::FunctionDefinition): {
+            if ((Item.Function = ParseDefinition())) {
+                Item.Kind = ParsedItem::Definition;
+            } else {
+                // Skip token for error recovery.
+                getNextToken();
+            }
+            break;
+        }
+        case static_cast<int>(Token::ExternKeyword): {
+            if ((Item.Proto = ParseExtern())) {
+                Item.Kind = ParsedItem::Extern;
+            } else {
+                // Skip token for error recovery.
+                getNextToken();
+            }
+            break;
+        }
+        case ':': {
+            getNextToken();  // eat ':'.
+            if (CurTok != static_cast<int>(Token::Identifier)) {
+                fprintf(ReplOut, "LogError: Expected command name after ':'\n");
+                break;
+            }
+            Item.Kind = ParsedItem::Command;
+            Item.CommandName = getTokenText();
+            getNextToken();  // eat the command name.
+            break;
+        }
+        default: {
+            if ((Item.Function = ParseTopLevelExpr())) {
+                Item.Kind = ParsedItem::Expression;
+            } else {
+                // Skip token for error recovery.
+                getNextToken();
+            }
+            break;
+        }
+    }
+    return Item;
+}
+
+//! ProduceItems - The body of the producer thread: parse the input into the queue, up to and including
+//! the end of the input. Parse errors are captured with the item they belong to.
+static void ProduceItems(FILE *In, map<char, int> Precedence, ItemQueue &Queue) {
+    ReplIn = In;
+    BinOpPrecedence = move(Precedence);
+
+    char *Buffer = nullptr;
+    size_t Size = 0;
+    size_t Taken = 0;
+    FILE *Diagnostics = open_memstream(&Buffer, &Size);
+    if (Diagnostics) {
+        ReplOut = Diagnostics;
+    }
+
+    getNextToken();
+    while (1) {
+        compactTokens();
+        ParsedItem Item = ParseItem();
+        if (Diagnostics) {
+            fflush(Diagnostics);
+            Item.Diagnostics.assign(Buffer + Taken, Size - Taken);
+            Taken = Size;
+        }
+
+        bool Done = Item.Kind == ParsedItem::EndOfFile;
+        Queue.push(move(Item));
+        if (Done) {
+            break;
+        }
+    }
+
+    ResetLexer();
+    if (Diagnostics) {
+        fclose(Diagnostics);
+        free(Buffer);
+    }
+}
+
+void PipelinedMainLoop() {
+    ItemQueue Queue;
+    thread Producer(ProduceItems, ReplIn, BinOpPrecedence, ref(Queue));
+
+    fprintf(ReplOut, "ready> ");
+    while (1) {
+        // Between items is a safe point for tier-ups requested by other threads.
+        ProcessPendingTierUps();
+
+        fprintf(ReplOut, "ready> ");
+        fflush(ReplOut);
+        ParsedItem Item = Queue.pop();
+        fputs(Item.Diagnostics.c_str(), ReplOut);
+
+        switch (Item.Kind) {
+            case ParsedItem::EndOfFile: {
+                Producer.join();
+                return;
+            }
+            case ParsedItem::Empty: {
+                break;
+            }
+            case ParsedItem::Definition: {
+                CompileDefinition(move(Item.Function));
+                break;
+            }
+            case ParsedItem::Extern: {
+                CompileExtern(move(Item.Proto));
+                break;
+            }
+            case ParsedItem::Command: {
+                RunCommand(Item.CommandName);
+                break;
+            }
+            case ParsedItem::Expression: {
+                EvaluateTopLevelExpression(move(Item.Function));
+                break;
+            }
+        }
+    }
+}
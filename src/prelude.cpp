@@ -0,0 +1,231 @@
+//
+// A prelude of definitions that is compiled once and shared by every session.
+//
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "prelude.h"
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "analysis.h"
+#include "toplevel.h"
+#include "jit.h"
+#include "memo.h"
+#include "tiered.h"
+#include "depgraph.h"
+#include "profile.h"
+#include "simd.h"
+#include "parallel.h"
+#include "session.h"
+#include "helper.h"
+
+//! PreludeObject - The object code of one module compiled while loading the prelude, and the names
+//! of the functions it defines.
+struct PreludeObject {
+    unique_ptr<MemoryBuffer> Buffer;
+    unique_ptr<object::ObjectFile> Object;
+    vector<string> Definitions;
+};
+
+//! PreludeObjectCache - Keeps a copy of the object code of every module compiled by the JIT.
+class PreludeObjectCache : public ObjectCache {
+public:
+    vector<PreludeObject> Objects;
+
+    void notifyObjectCompiled(const Module *M, MemoryBufferRef Obj) override {
+        // Top-level expressions are run once and then removed from the JIT.
+        if (M->getFunction("__anon_expr")) {
+            return;
+        }
+
+        PreludeObject Record;
+        Record.Buffer = MemoryBuffer::getMemBufferCopy(Obj.getBuffer(), M->getModuleIdentifier());
+        auto Object = object::ObjectFile::createObjectFile(Record.Buffer->getMemBufferRef());
+        if (!Object) {
+            consumeError(Object.takeError());
+            return;
+        }
+        Record.Object = move(*Object);
+
+        for (auto &F : *M) {
+            if (!F.isDeclaration() && !F.hasLocalLinkage()) {
+                Record.Definitions.push_back(F.getName().str());
+            }
+        }
+        Objects.push_back(move(Record));
+    }
+
+    unique_ptr<MemoryBuffer> getObject(const Module *M) override {
+        return nullptr;
+    }
+};
+
+static string PreludeSource;
+static PreludeObjectCache PreludeCache;
+
+//! PreludeFunctions/PreludeDefinitions - The prototypes and definitions that were current once the
+//! prelude was loaded; definitions that failed to compile are not among them.
+static set<string> PreludeFunctions;
+static set<string> PreludeDefinitions;
+
+//! PreludeMemoCaches - The caches of the memoized prelude definitions, owned by the loading session.
+static vector<MemoCache *> PreludeMemoCaches;
+
+//! OpenSource - Point the lexer of the current thread at the prelude source.
+static FILE *OpenSource() {
+    FILE *Source = fmemopen(const_cast<char *>(PreludeSource.data()), PreludeSource.size(), "r");
+    if (Source) {
+        ReplIn = Source;
+        ResetLexer();
+    }
+    return Source;
+}
+
+static void CloseSource(FILE *Source, FILE *SavedIn) {
+    ReplIn = SavedIn;
+    ResetLexer();
+    fclose(Source);
+}
+
+bool LoadPrelude(const string &Path) {
+    ifstream File(Path);
+    if (!File) {
+        return false;
+    }
+    stringstream Contents;
+    Contents << File.rdbuf();
+    PreludeSource = Contents.str();
+
+    FILE *SavedIn = ReplIn;
+    FILE *Source = OpenSource();
+    if (!Source) {
+        return PreludeSource.empty();
+    }
+
+    bool Tiered = TieredCompilationEnabled;
+    TieredCompilationEnabled = false;
+    TheJIT->setObjectCache(&PreludeCache);
+
+    getNextToken();
+    MainLoop();
+
+    TheJIT->setObjectCache(nullptr);
+    TieredCompilationEnabled = Tiered;
+    CloseSource(Source, SavedIn);
+
+    for (auto &Proto : FunctionProtos) {
+        PreludeFunctions.insert(Proto.first);
+    }
+    for (auto &Def : FunctionDefs) {
+        PreludeDefinitions.insert(Def.first);
+        if (Def.second->isMemo()) {
+            if (MemoCache *Cache = GetMemoCache(Def.first)) {
+                PreludeMemoCaches.push_back(Cache);
+            }
+        }
+    }
+    return true;
+}
+
+//! ParsePrelude - Read the prelude's definitions and externs into FunctionDefs and FunctionProtos,
+//! without compiling anything. Top-level expressions and commands are skipped.
+static void ParsePrelude() {
+    getNextToken();
+    while (CurTok != static_cast<int>(Token::EndOfFile)) {
+        switch (CurTok) {
+            case static_cast<int>(Token::FunctionDefinition): {
+                auto FnAST = ParseDefinition();
+                if (!FnAST) {
+                    getNextToken();
+                    break;
+                }
+
+                string Name = FnAST->getProto().getName();
+                auto Proto = helper::make_unique<PrototypeAST>(FnAST->getProto());
+                Proto->setReturnType(InferType(FnAST->getBody(), *Proto));
+                FunctionProtos[Name] = move(Proto);
+                if (isPureBody(Name, FnAST->getBody())) {
+                    PureFunctions.insert(Name);
+                } else {
+                    PureFunctions.erase(Name);
+                }
+                FunctionDefs[Name] = move(FnAST);
+                break;
+            }
+            case static_cast<int>(Token::ExternKeyword): {
+                if (auto ProtoAST = ParseExtern()) {
+                    FunctionProtos[ProtoAST->getName()] = move(ProtoAST);
+                } else {
+                    getNextToken();
+                }
+                break;
+            }
+            case ':': {
+                getNextToken();  // eat ':'.
+                getNextToken();  // eat the command name.
+                break;
+            }
+            case ';': {
+                getNextToken();
+                break;
+            }
+            default: {
+                if (!ParseTopLevelExpr()) {
+                    getNextToken();
+                }
+                break;
+            }
+        }
+    }
+}
+
+void RestorePrelude() {
+    if (PreludeSource.empty()) {
+        return;
+    }
+
+    FILE *SavedIn = ReplIn;
+    FILE *Source = OpenSource();
+    if (!Source) {
+        return;
+    }
+    ParsePrelude();
+    CloseSource(Source, SavedIn);
+
+    // Only keep what survived loading the prelude.
+    for (auto Def = FunctionDefs.begin(); Def != FunctionDefs.end();) {
+        if (PreludeDefinitions.count(Def->first)) {
+            ++Def;
+            continue;
+        }
+        PureFunctions.erase(Def->first);
+        Def = FunctionDefs.erase(Def);
+    }
+    for (auto Proto = FunctionProtos.begin(); Proto != FunctionProtos.end();) {
+        Proto = PreludeFunctions.count(Proto->first) ? next(Proto) : FunctionProtos.erase(Proto);
+    }
+
+    // The objects may call into the runtime, which only the session that compiled them has registered.
+    DeclareParallelRuntime();
+
+    // Link the objects in the order they were compiled, so that the newest code of a function that
+    // was defined more than once is found first, just like in the loading session.
+    for (auto &Object : PreludeCache.Objects) {
+        TheJIT->addObject(*Object.Object);
+        for (auto &Name : Object.Definitions) {
+            DeclareProfileCounters(Name);
+        }
+    }
+    RestoreDefinitions(PreludeDefinitions);
+
+    for (MemoCache *Cache : PreludeMemoCaches) {
+        AdoptMemoCache(*Cache);
+    }
+}
@@ -0,0 +1,149 @@
+//
+// An instrumenting profiler that counts calls and cycles inside the generated code.
+//
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <llvm/IR/Intrinsics.h>
+
+#include "profile.h"
+#include "jit.h"
+#include "session.h"
+#include "helper.h"
+
+bool ProfilingEnabled = false;
+
+//! Profile - The counters of every profiled function of the session, keyed by function name.
+//! Redefinitions keep counting into the same counters.
+static thread_local map<string, unique_ptr<ProfileCounters>> Profile;
+
+//! ChildCycles - The cycles spent in the callees of the function that currently runs on this thread.
+static thread_local uint64_t ChildCycles = 0;
+
+//! chickadee_profile_children - Called by profiled code for the child cycle accumulator of its thread.
+extern "C" uint64_t *chickadee_profile_children() {
+    return &ChildCycles;
+}
+
+//! SourceFunction - The definition that the function named Symbol was generated from: user names are
+//! alphanumeric, so everything from the first '.' on marks a clone, as in "f.spec3" or "f.tier1.2".
+static string SourceFunction(const string &Symbol) {
+    return Symbol.substr(0, Symbol.find('.'));
+}
+
+static string CountersSymbol(const string &Function) {
+    return "__profile." + Function;
+}
+
+static ProfileCounters &GetCounters(const string &Function) {
+    auto &Counters = Profile[Function];
+    if (!Counters) {
+        Counters = helper::make_unique<ProfileCounters>();
+    }
+    TheJIT->addRuntimeSymbol(CountersSymbol(Function), Counters.get());
+    TheJIT->addRuntimeSymbol("chickadee_profile_children", (void *) &chickadee_profile_children);
+    return *Counters;
+}
+
+ProfileFrame EmitProfileEntry(IRBuilder<> &Builder, const string &Symbol) {
+    ProfileFrame Frame;
+    string Source = SourceFunction(Symbol);
+    if (!ProfilingEnabled || Source == "__anon_expr") {
+        return Frame;
+    }
+    GetCounters(Source);
+
+    Module *M = Builder.GetInsertBlock()->getModule();
+    LLVMContext &Context = M->getContext();
+    Type *Int64Ty = Type::getInt64Ty(Context);
+    StructType *CountersTy = StructType::get(Context, {Int64Ty, Int64Ty, Int64Ty});
+    Frame.Counters = M->getOrInsertGlobal(CountersSymbol(Source), CountersTy);
+
+    // The callees of this call accumulate their cycles from zero; the caller's sum is restored on exit.
+    FunctionType *ChildrenTy = FunctionType::get(Int64Ty->getPointerTo(), false);
+    Frame.Children = Builder.CreateCall(M->getOrInsertFunction("chickadee_profile_children", ChildrenTy),
+                                        {}, "children");
+    Frame.SavedChildren = Builder.CreateLoad(Frame.Children, "savedchildren");
+    Builder.CreateStore(Builder.getInt64(0), Frame.Children);
+
+    Function *ReadCycles = Intrinsic::getDeclaration(M, Intrinsic::readcyclecounter);
+    Frame.Start = Builder.CreateCall(ReadCycles, {}, "start");
+    return Frame;
+}
+
+void EmitProfileExit(IRBuilder<> &Builder, const ProfileFrame &Frame) {
+    if (!Frame.Counters) {
+        return;
+    }
+
+    Module *M = Builder.GetInsertBlock()->getModule();
+    Function *ReadCycles = Intrinsic::getDeclaration(M, Intrinsic::readcyclecounter);
+    Value *Elapsed = Builder.CreateSub(Builder.CreateCall(ReadCycles, {}, "end"), Frame.Start, "elapsed");
+    Value *Children = Builder.CreateLoad(Frame.Children, "childcycles");
+
+    auto Add = [&](unsigned Field, Value *Amount) {
+        Builder.CreateAtomicRMW(AtomicRMWInst::Add, Builder.CreateStructGEP(nullptr, Frame.Counters, Field),
+                                Amount, AtomicOrdering::Monotonic);
+    };
+    Add(0, Builder.getInt64(1));
+    Add(1, Elapsed);
+    Add(2, Builder.CreateSub(Elapsed, Children, "selfcycles"));
+
+    // To the caller, this whole call is time spent in a callee.
+    Builder.CreateStore(Builder.CreateAdd(Frame.SavedChildren, Elapsed), Frame.Children);
+}
+
+void DeclareProfileCounters(const string &Symbol) {
+    if (ProfilingEnabled) {
+        GetCounters(SourceFunction(Symbol));
+    }
+}
+
+void ResetProfile() {
+    Profile.clear();
+}
+
+void PrintProfile() {
+    if (!ProfilingEnabled) {
+        fprintf(ReplOut, "Profiling is disabled; run with --profile.\n");
+        return;
+    }
+
+    struct Row {
+        const string *Function;
+        uint64_t Calls;
+        uint64_t Inclusive;
+        uint64_t Exclusive;
+    };
+    vector<Row> Rows;
+    uint64_t TotalExclusive = 0;
+    for (auto &Entry : Profile) {
+        ProfileCounters &Counters = *Entry.second;
+        Row R{&Entry.first,
+              __atomic_load_n(&Counters.Calls, __ATOMIC_RELAXED),
+              __atomic_load_n(&Counters.InclusiveCycles, __ATOMIC_RELAXED),
+              __atomic_load_n(&Counters.ExclusiveCycles, __ATOMIC_RELAXED)};
+        if (R.Calls) {
+            Rows.push_back(R);
+            TotalExclusive += R.Exclusive;
+        }
+    }
+    if (Rows.empty()) {
+        fprintf(ReplOut, "No profiled calls.\n");
+        return;
+    }
+    sort(Rows.begin(), Rows.end(), [](const Row &A, const Row &B) { return A.Exclusive > B.Exclusive; });
+
+    fprintf(ReplOut, "%-20s %14s %18s %18s %7s %14s\n",
+            "function", "calls", "inclusive cycles", "exclusive cycles", "self%", "cycles/call");
+    for (auto &R : Rows) {
+        fprintf(ReplOut, "%-20s %14llu %18llu %18llu %6.1f%% %14.1f\n",
+                R.Function->c_str(),
+                (unsigned long long) R.Calls,
+                (unsigned long long) R.Inclusive,
+                (unsigned long long) R.Exclusive,
+                TotalExclusive ? 100.0 * R.Exclusive / TotalExclusive : 0.0,
+                static_cast<double>(R.Inclusive) / R.Calls);
+    }
+}
@@ -0,0 +1,134 @@
+//
+// Multi-session evaluation server on a local Unix domain socket.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "lexer.h"
+#include "toplevel.h"
+#include "prelude.h"
+#include "session.h"
+#include "jit.h"
+#include "snapshot.h"
+
+//! Connections - Accepted connections waiting for a session thread.
+static mutex ConnectionsMutex;
+static condition_variable ConnectionsCondition;
+static deque<int> Connections;
+
+//! ServeSession - Run a REPL session for one client on the current thread, and tear it down afterwards.
+static void ServeSession(int Socket) {
+    // Reading and writing go through separate streams, each owning a descriptor of the socket.
+    int OutSocket = dup(Socket);
+    FILE *In = fdopen(Socket, "r");
+    FILE *Out = OutSocket >= 0 ? fdopen(OutSocket, "w") : nullptr;
+    if (!In || !Out) {
+        fprintf(stderr, "LogError: Cannot open session streams: %s\n", strerror(errno));
+        if (In) {
+            fclose(In);
+        } else {
+            close(Socket);
+        }
+        if (Out) {
+            fclose(Out);
+        } else if (OutSocket >= 0) {
+            close(OutSocket);
+        }
+        return;
+    }
+
+    ReplIn = In;
+    ReplOut = Out;
+    {
+        lock_guard<recursive_mutex> Lock(CompileMutex);
+        InitializeSession();
+        RestorePrelude();
+        RestoreSessionSnapshot();
+    }
+
+    fprintf(ReplOut, "ready> ");
+    fflush(ReplOut);
+    getNextToken();
+    MainLoop();
+
+    ResetSession();
+    ReplIn = stdin;
+    ReplOut = stderr;
+    fclose(In);
+    fclose(Out);
+}
+
+static void RunSessionThread() {
+    while (true) {
+        int Socket;
+        {
+            unique_lock<mutex> Lock(ConnectionsMutex);
+            ConnectionsCondition.wait(Lock, [] { return !Connections.empty(); });
+            Socket = Connections.front();
+            Connections.pop_front();
+        }
+        ServeSession(Socket);
+    }
+}
+
+int RunServer(const string &Path, unsigned Threads) {
+    sockaddr_un Address;
+    memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Address.sun_path)) {
+        fprintf(stderr, "LogError: Socket path too long: %s\n", Path.c_str());
+        return 1;
+    }
+    strncpy(Address.sun_path, Path.c_str(), sizeof(Address.sun_path) - 1);
+
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        fprintf(stderr, "LogError: Cannot create socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    unlink(Path.c_str());
+    if (::bind(Listener, (sockaddr *) &Address, sizeof(Address)) < 0 || listen(Listener, SOMAXCONN) < 0) {
+        fprintf(stderr, "LogError: Cannot listen on %s: %s\n", Path.c_str(), strerror(errno));
+        close(Listener);
+        return 1;
+    }
+
+    // A client that hangs up must not take the whole server down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (Threads == 0) {
+        Threads = max(1u, thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i != Threads; ++i) {
+        thread(RunSessionThread).detach();
+    }
+    fprintf(stderr, "Listening on %s with %u session thread(s)\n", Path.c_str(), Threads);
+
+    while (true) {
+        int Socket = accept(Listener, nullptr, nullptr);
+        if (Socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "LogError: accept failed: %s\n", strerror(errno));
+            close(Listener);
+            return 1;
+        }
+
+        lock_guard<mutex> Lock(ConnectionsMutex);
+        Connections.push_back(Socket);
+        ConnectionsCondition.notify_one();
+    }
+}
@@ -0,0 +1,76 @@
+//
+// REPL sessions: the streams a session talks through and the lifetime of its compiler state.
+//
+
+#include <mutex>
+#include <llvm/Support/raw_ostream.h>
+
+#include "session.h"
+#include "lexer.h"
+#include "parser.h"
+#include "codegen.h"
+#include "optimizer.h"
+#include "analysis.h"
+#include "jit.h"
+#include "memo.h"
+#include "peval.h"
+#include "tiered.h"
+#include "depgraph.h"
+#include "jitevents.h"
+#include "profile.h"
+#include "gc.h"
+#include "snapshot.h"
+#include "target.h"
+#include "helper.h"
+
+thread_local FILE *ReplIn = stdin;
+thread_local FILE *ReplOut = stderr;
+
+void PrintIR(const Value &V) {
+    // Keep the IR in order with what was already written through the FILE buffer.
+    fflush(ReplOut);
+    raw_fd_ostream Out(fileno(ReplOut), false);
+    V.print(Out);
+    Out << '\n';
+}
+
+void InitializeSession() {
+    // Install standard binary operators.
+    // 1 is lowest precedence.
+    BinOpPrecedence['<'] = 10;
+    BinOpPrecedence['+'] = 20;
+    BinOpPrecedence['-'] = 20;
+    BinOpPrecedence['*'] = 40;  // highest.
+
+    // prepare the Just-in-Time compiler
+    TheJIT = helper::make_unique<KaleidoscopeJIT>(GetTargetCPU(), GetTargetAttributes());
+    TheJIT->setObjectObserver(GetJITEventObserver());
+    InitializeModuleAndPassManager();
+}
+
+void ClearSession() {
+    // The background compiler must be done with the session before its JIT goes away.
+    ResetTieredCompilation();
+
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    ResetDependencyGraph();
+    ResetPartialEvaluation();
+    ResetMemoCaches();
+    ResetProfile();
+    ResetGarbageStats();
+
+    FunctionDefs.clear();
+    FunctionProtos.clear();
+    PureFunctions.clear();
+    BinOpPrecedence.clear();
+
+    TheFPM.reset();
+    TheModule.reset();
+    TheJIT.reset();
+    ResetSnapshots();
+}
+
+void ResetSession() {
+    ClearSession();
+    ResetLexer();
+}
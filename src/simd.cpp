@@ -0,0 +1,182 @@
+//
+// Fixed-width vectors of doubles, lowered to LLVM vector types.
+//
+
+#include <llvm/IR/Constants.h>
+
+#include "simd.h"
+#include "codegen.h"
+
+bool ParseValueType(const string &Name, ValueType &VT) {
+    if (Name == "double") {
+        VT = ValueType::Double;
+    } else if (Name == "vec2") {
+        VT = ValueType::Vec2;
+    } else if (Name == "vec4") {
+        VT = ValueType::Vec4;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Type *getLLVMType(ValueType VT) {
+    if (VT == ValueType::Double) {
+        return Type::getDoubleTy(TheContext);
+    }
+    return VectorType::get(Type::getDoubleTy(TheContext), static_cast<unsigned>(VT));
+}
+
+unsigned getLaneCount(Type *T) {
+    return T->isVectorTy() ? T->getVectorNumElements() : 1;
+}
+
+static ValueType Wider(ValueType A, ValueType B) {
+    return static_cast<unsigned>(A) > static_cast<unsigned>(B) ? A : B;
+}
+
+ValueType InferType(const ExprAST &E, const PrototypeAST &P) {
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            return ValueType::Double;
+        }
+        case ExprAST::EK_Variable: {
+            auto &Args = P.getArgs();
+            for (size_t i = 0; i != Args.size(); ++i) {
+                if (Args[i] == cast<VariableExprAST>(E).getName()) {
+                    return P.getTypes()[i];
+                }
+            }
+            return ValueType::Double;
+        }
+        case ExprAST::EK_Binary: {
+            // Scalars are splatted to the width of the vector operand.
+            auto &B = cast<BinaryExprAST>(E);
+            return Wider(InferType(B.getLHS(), P), InferType(B.getRHS(), P));
+        }
+        case ExprAST::EK_Call: {
+            auto &Callee = cast<CallExprAST>(E).getCallee();
+            if (isVectorBuiltin(Callee)) {
+                return Callee == "vec2" ? ValueType::Vec2 : Callee == "vec4" ? ValueType::Vec4 : ValueType::Double;
+            }
+            auto Proto = FunctionProtos.find(Callee);
+            if (Proto != FunctionProtos.end()) {
+                return Proto->second->getReturnType();
+            }
+            return ValueType::Double;
+        }
+        case ExprAST::EK_Shared: {
+            return InferType(cast<SharedExprAST>(E).getExpr(), P);
+        }
+    }
+    return ValueType::Double;
+}
+
+bool isVectorBuiltin(const string &Name) {
+    return (Name == "vec2" || Name == "vec4" || Name == "lane" || Name == "hsum" || Name == "hmin" || Name == "hmax")
+           && !FunctionProtos.count(Name);
+}
+
+Value *EmitSplat(IRBuilder<> &Builder, Value *Scalar, Value *Vector) {
+    return Builder.CreateVectorSplat(getLaneCount(Vector->getType()), Scalar, "splat");
+}
+
+//! EmitReduction - Combine the lanes of V pairwise, folding the upper half of the vector onto the
+//! lower half until one lane is left, which is the shape the backend turns into packed operations.
+static Value *EmitReduction(IRBuilder<> &Builder, Value *V, const string &Builtin) {
+    unsigned Lanes = getLaneCount(V->getType());
+    if (Lanes == 1) {
+        return V;
+    }
+
+    for (unsigned Width = Lanes / 2; Width >= 1; Width /= 2) {
+        vector<Constant *> Mask;
+        for (unsigned i = 0; i != Lanes; ++i) {
+            Mask.push_back(i < Width ? Builder.getInt32(i + Width) : UndefValue::get(Builder.getInt32Ty()));
+        }
+        Value *Upper = Builder.CreateShuffleVector(V, UndefValue::get(V->getType()), ConstantVector::get(Mask),
+                                                   "upper");
+        if (Builtin == "hsum") {
+            V = Builder.CreateFAdd(V, Upper, "sumtmp");
+        } else {
+            Value *Keep = Builtin == "hmin" ? Builder.CreateFCmpOLT(V, Upper) : Builder.CreateFCmpOGT(V, Upper);
+            V = Builder.CreateSelect(Keep, V, Upper, Builtin == "hmin" ? "mintmp" : "maxtmp");
+        }
+    }
+    return Builder.CreateExtractElement(V, Builder.getInt32(0), "reduced");
+}
+
+Value *EmitVectorBuiltin(IRBuilder<> &Builder, const CallExprAST &Call) {
+    auto &Builtin = Call.getCallee();
+    auto &Args = Call.getArgs();
+
+    vector<Value *> ArgsV;
+    for (auto &Arg : Args) {
+        ArgsV.push_back(Arg->codegen());
+        if (!ArgsV.back()) {
+            return nullptr;
+        }
+    }
+
+    if (Builtin == "vec2" || Builtin == "vec4") {
+        unsigned Lanes = Builtin == "vec2" ? 2 : 4;
+        if (ArgsV.size() != 1 && ArgsV.size() != Lanes) {
+            return LogErrorV("Incorrect # arguments passed");
+        }
+        for (auto *V : ArgsV) {
+            if (V->getType()->isVectorTy()) {
+                return LogErrorV("Vector lanes must be scalars");
+            }
+        }
+        if (ArgsV.size() == 1) {
+            return Builder.CreateVectorSplat(Lanes, ArgsV[0], "splat");
+        }
+
+        Value *V = UndefValue::get(VectorType::get(Builder.getDoubleTy(), Lanes));
+        for (unsigned i = 0; i != Lanes; ++i) {
+            V = Builder.CreateInsertElement(V, ArgsV[i], Builder.getInt32(i), "vectmp");
+        }
+        return V;
+    }
+
+    if (Builtin == "lane") {
+        if (ArgsV.size() != 2) {
+            return LogErrorV("Incorrect # arguments passed");
+        }
+        unsigned Lanes = getLaneCount(ArgsV[0]->getType());
+        if (Lanes == 1 || ArgsV[1]->getType()->isVectorTy()) {
+            return LogErrorV("lane expects a vector and a scalar index");
+        }
+
+        // Constant indices, the common case, select the lane directly.
+        Value *Index;
+        if (auto *N = dyn_cast<NumberExprAST>(Args[1].get())) {
+            Index = Builder.getInt32(static_cast<uint32_t>(static_cast<int64_t>(N->getValue())) & (Lanes - 1));
+        } else {
+            Index = Builder.CreateAnd(Builder.CreateFPToSI(ArgsV[1], Builder.getInt32Ty()), Lanes - 1, "lanetmp");
+        }
+        return Builder.CreateExtractElement(ArgsV[0], Index, "lanetmp");
+    }
+
+    // hsum, hmin and hmax; the reduction of a scalar is the scalar itself.
+    if (ArgsV.size() != 1) {
+        return LogErrorV("Incorrect # arguments passed");
+    }
+    return EmitReduction(Builder, ArgsV[0], Builtin);
+}
+
+Function *EmitLaneStore(Function *F, const string &Name) {
+    LLVMContext &Context = F->getContext();
+    Type *DoubleTy = Type::getDoubleTy(Context);
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(Context), {DoubleTy->getPointerTo()}, false);
+    Function *Store = Function::Create(FT, Function::ExternalLinkage, Name, F->getParent());
+
+    IRBuilder<> B(BasicBlock::Create(Context, "entry", Store));
+    Value *Result = B.CreateCall(F, {}, "result");
+    Value *Out = &*Store->arg_begin();
+    for (unsigned i = 0, e = getLaneCount(F->getReturnType()); i != e; ++i) {
+        B.CreateStore(B.CreateExtractElement(Result, B.getInt32(i)), B.CreateConstGEP1_32(Out, i));
+    }
+    B.CreateRetVoid();
+    return Store;
+}
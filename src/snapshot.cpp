@@ -0,0 +1,592 @@
+//
+// Saving a session to a file and restoring it without parsing or compiling anything.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <vector>
+#include <unistd.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "snapshot.h"
+#include "parser.h"
+#include "codegen.h"
+#include "analysis.h"
+#include "jit.h"
+#include "memo.h"
+#include "peval.h"
+#include "tiered.h"
+#include "depgraph.h"
+#include "parallel.h"
+#include "profile.h"
+#include "session.h"
+#include "target.h"
+#include "helper.h"
+
+string SnapshotPath = "chickadee.snapshot";
+bool SnapshotRestoreEnabled = false;
+
+//! A snapshot is a sequence of sections in host byte order, each starting with the number of its records:
+//!   header          magic, version, target triple, data layout, target CPU and the features it enables, whether
+//!                   the code is profiled, the number of specializations created so far
+//!   precedences     (operator, precedence)
+//!   prototypes      (prototype) for every entry of FunctionProtos
+//!   definitions     (prototype, memo, pure, body)
+//!   memo caches     (function, symbol, arity, current, words), the words aligned to 8 bytes
+//!   tier slots      (function, symbol, generation, optimized function or "", current)
+//!   objects         (size, bytes), the bytes aligned to 16 bytes so they can be used in place
+//! The target triple, data layout and enabled features guard against loading object code that cannot run on
+//! this host. The features are the ones the code generator actually used, so those implied by --cpu count too.
+static const char SnapshotMagic[8] = {'C', 'K', 'S', 'N', 'A', 'P', '\0', '\0'};
+static const uint32_t SnapshotVersion = 3;
+
+//! LoadedSnapshot - A snapshot file mapped into memory, and the object files that live inside of it.
+//! Both must outlive the JIT the objects are linked into.
+struct LoadedSnapshot {
+    unique_ptr<MemoryBuffer> Buffer;
+    vector<unique_ptr<object::ObjectFile>> Objects;
+};
+
+static thread_local vector<unique_ptr<LoadedSnapshot>> Snapshots;
+
+class SnapshotWriter {
+public:
+    string Data;
+
+    template<typename T>
+    void write(T Value) {
+        Data.append(reinterpret_cast<const char *>(&Value), sizeof(Value));
+    }
+
+    void writeBytes(const void *Bytes, size_t Size) {
+        Data.append(static_cast<const char *>(Bytes), Size);
+    }
+
+    void writeString(const string &S) {
+        write<uint32_t>(static_cast<uint32_t>(S.size()));
+        Data += S;
+    }
+
+    void align(size_t Alignment) {
+        Data.resize((Data.size() + Alignment - 1) / Alignment * Alignment, '\0');
+    }
+};
+
+//! SnapshotReader - Reads what SnapshotWriter wrote, checking every read against the end of the buffer.
+//! Once a read fails, all further reads fail too and return empty values.
+class SnapshotReader {
+    const char *_begin;
+    const char *_pos;
+    const char *_end;
+    bool _failed = false;
+
+public:
+    explicit SnapshotReader(StringRef Buffer)
+            : _begin(Buffer.begin()), _pos(Buffer.begin()), _end(Buffer.end()) {}
+
+    bool failed() const { return _failed; }
+
+    const char *readBytes(size_t Size) {
+        if (_failed || static_cast<size_t>(_end - _pos) < Size) {
+            _failed = true;
+            return nullptr;
+        }
+        const char *Bytes = _pos;
+        _pos += Size;
+        return Bytes;
+    }
+
+    template<typename T>
+    T read() {
+        T Value = T();
+        if (const char *Bytes = readBytes(sizeof(Value))) {
+            memcpy(&Value, Bytes, sizeof(Value));
+        }
+        return Value;
+    }
+
+    string readString() {
+        uint32_t Size = read<uint32_t>();
+        const char *Bytes = readBytes(Size);
+        return Bytes ? string(Bytes, Size) : string();
+    }
+
+    void align(size_t Alignment) {
+        size_t Offset = static_cast<size_t>(_pos - _begin);
+        readBytes((Offset + Alignment - 1) / Alignment * Alignment - Offset);
+    }
+};
+
+static void WritePrototype(SnapshotWriter &W, const PrototypeAST &Proto) {
+    W.writeString(Proto.getName());
+    W.write<uint32_t>(static_cast<uint32_t>(Proto.getArgs().size()));
+    for (size_t i = 0; i != Proto.getArgs().size(); ++i) {
+        W.writeString(Proto.getArgs()[i]);
+        W.write<uint8_t>(static_cast<uint8_t>(Proto.getTypes()[i]));
+    }
+    W.write<uint8_t>(static_cast<uint8_t>(Proto.getReturnType()));
+}
+
+static bool ReadValueType(SnapshotReader &R, ValueType &Type) {
+    uint8_t Value = R.read<uint8_t>();
+    Type = static_cast<ValueType>(Value);
+    return Type == ValueType::Double || Type == ValueType::Vec2 || Type == ValueType::Vec4;
+}
+
+static unique_ptr<PrototypeAST> ReadPrototype(SnapshotReader &R) {
+    string Name = R.readString();
+    uint32_t Count = R.read<uint32_t>();
+    vector<string> Args;
+    vector<ValueType> Types;
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        Args.push_back(R.readString());
+        Types.emplace_back();
+        if (!ReadValueType(R, Types.back())) {
+            return nullptr;
+        }
+    }
+
+    ValueType ReturnType;
+    if (!ReadValueType(R, ReturnType) || R.failed()) {
+        return nullptr;
+    }
+    auto Proto = helper::make_unique<PrototypeAST>(Name, move(Args), move(Types));
+    Proto->setReturnType(ReturnType);
+    return Proto;
+}
+
+//! WriteExpr - Write an expression tree in prefix order. Shared subexpressions are written out in full;
+//! hash-consing finds them again when the definition is compiled.
+static void WriteExpr(SnapshotWriter &W, const ExprAST &E) {
+    if (auto *Shared = dyn_cast<SharedExprAST>(&E)) {
+        WriteExpr(W, Shared->getExpr());
+        return;
+    }
+
+    W.write<uint8_t>(static_cast<uint8_t>(E.getKind()));
+    switch (E.getKind()) {
+        case ExprAST::EK_Number: {
+            W.write<double>(cast<NumberExprAST>(E).getValue());
+            break;
+        }
+        case ExprAST::EK_Variable: {
+            W.writeString(cast<VariableExprAST>(E).getName());
+            break;
+        }
+        case ExprAST::EK_Binary: {
+            auto &B = cast<BinaryExprAST>(E);
+            W.write<char>(B.getOp());
+            WriteExpr(W, B.getLHS());
+            WriteExpr(W, B.getRHS());
+            break;
+        }
+        case ExprAST::EK_Call: {
+            auto &C = cast<CallExprAST>(E);
+            W.writeString(C.getCallee());
+            W.write<uint32_t>(static_cast<uint32_t>(C.getArgs().size()));
+            for (auto &Arg : C.getArgs()) {
+                WriteExpr(W, *Arg);
+            }
+            break;
+        }
+        case ExprAST::EK_Shared: {
+            break;
+        }
+    }
+}
+
+static unique_ptr<ExprAST> ReadExpr(SnapshotReader &R) {
+    uint8_t Kind = R.read<uint8_t>();
+    if (R.failed()) {
+        return nullptr;
+    }
+
+    switch (Kind) {
+        case ExprAST::EK_Number: {
+            double Value = R.read<double>();
+            return R.failed() ? nullptr : helper::make_unique<NumberExprAST>(Value);
+        }
+        case ExprAST::EK_Variable: {
+            string Name = R.readString();
+            return R.failed() ? nullptr : helper::make_unique<VariableExprAST>(Name);
+        }
+        case ExprAST::EK_Binary: {
+            char Op = R.read<char>();
+            auto LHS = ReadExpr(R);
+            auto RHS = LHS ? ReadExpr(R) : nullptr;
+            return RHS ? helper::make_unique<BinaryExprAST>(Op, move(LHS), move(RHS)) : nullptr;
+        }
+        case ExprAST::EK_Call: {
+            string Callee = R.readString();
+            uint32_t Count = R.read<uint32_t>();
+            vector<unique_ptr<ExprAST>> Args;
+            for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+                Args.push_back(ReadExpr(R));
+                if (!Args.back()) {
+                    return nullptr;
+                }
+            }
+            return R.failed() ? nullptr : helper::make_unique<CallExprAST>(Callee, move(Args));
+        }
+        default: {
+            return nullptr;
+        }
+    }
+}
+
+//! DefinedSymbols - The names of the global symbols that an object defines.
+static vector<string> DefinedSymbols(const object::ObjectFile &Obj) {
+    vector<string> Names;
+    for (auto &Sym : Obj.symbols()) {
+        uint32_t Flags = Sym.getFlags();
+        if ((Flags & object::SymbolRef::SF_Undefined) || !(Flags & object::SymbolRef::SF_Global)) {
+            continue;
+        }
+        Expected<StringRef> Name = Sym.getName();
+        if (!Name) {
+            consumeError(Name.takeError());
+            continue;
+        }
+        Names.push_back(Name->str());
+    }
+    return Names;
+}
+
+bool SaveSnapshot(const string &Path) {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    TargetMachine &TM = TheJIT->getTargetMachine();
+
+    SnapshotWriter W;
+    W.writeBytes(SnapshotMagic, sizeof(SnapshotMagic));
+    W.write<uint32_t>(SnapshotVersion);
+    W.writeString(TM.getTargetTriple().str());
+    W.writeString(TM.createDataLayout().getStringRepresentation());
+    W.writeString(GetTargetCPU());
+    W.writeString(GetEnabledFeatures(*TM.getMCSubtargetInfo()));
+    W.write<uint8_t>(ProfilingEnabled);
+    W.write<uint32_t>(GetSpecializationCount());
+
+    W.write<uint32_t>(static_cast<uint32_t>(BinOpPrecedence.size()));
+    for (auto &Op : BinOpPrecedence) {
+        W.write<char>(Op.first);
+        W.write<int32_t>(Op.second);
+    }
+
+    W.write<uint32_t>(static_cast<uint32_t>(FunctionProtos.size()));
+    for (auto &Proto : FunctionProtos) {
+        WritePrototype(W, *Proto.second);
+    }
+
+    W.write<uint32_t>(static_cast<uint32_t>(FunctionDefs.size()));
+    for (auto &Def : FunctionDefs) {
+        WritePrototype(W, Def.second->getProto());
+        W.write<uint8_t>(Def.second->isMemo());
+        W.write<uint8_t>(PureFunctions.count(Def.first) != 0);
+        WriteExpr(W, Def.second->getBody());
+    }
+
+    // Caches and slots that no code refers to anymore are left behind.
+    vector<MemoCache *> Caches;
+    for (MemoCache *Cache : GetMemoCaches()) {
+        if (GetMemoCache(Cache->getFunction()) == Cache || TheJIT->isSymbolReferenced(Cache->getSymbol())) {
+            Caches.push_back(Cache);
+        }
+    }
+    W.write<uint32_t>(static_cast<uint32_t>(Caches.size()));
+    for (MemoCache *Cache : Caches) {
+        W.writeString(Cache->getFunction());
+        W.writeString(Cache->getSymbol());
+        W.write<uint32_t>(Cache->getArity());
+        W.write<uint8_t>(GetMemoCache(Cache->getFunction()) == Cache);
+        W.write<uint64_t>(Cache->getBytes());
+        W.align(8);
+        W.writeBytes(Cache->getWords(), Cache->getBytes());
+    }
+
+    vector<const TierSlot *> Slots;
+    for (const TierSlot *Slot : GetTierSlots()) {
+        if (TheJIT->isSymbolReferenced(Slot->Symbol)) {
+            Slots.push_back(Slot);
+        }
+    }
+    W.write<uint32_t>(static_cast<uint32_t>(Slots.size()));
+    for (const TierSlot *Slot : Slots) {
+        W.writeString(Slot->Function);
+        W.writeString(Slot->Symbol);
+        W.write<uint32_t>(Slot->Generation);
+        W.writeString(Slot->Tier == TierSlot::Optimized ? Slot->OptimizedSymbol : string());
+        W.write<uint8_t>(FindTierSlot(Slot->Function) == Slot);
+    }
+
+    vector<const object::ObjectFile *> Objects = TheJIT->getObjects();
+    W.write<uint32_t>(static_cast<uint32_t>(Objects.size()));
+    for (auto *Obj : Objects) {
+        StringRef Bytes = Obj->getData();
+        W.write<uint64_t>(Bytes.size());
+        W.align(16);
+        W.writeBytes(Bytes.data(), Bytes.size());
+    }
+
+    // Replace the file in one step, so that a crash never leaves a truncated snapshot behind.
+    // The temporary name is unique, so that sessions of the server saving to the same path at once do not
+    // write into each other's file.
+    string Temporary = Path + ".XXXXXX";
+    int Descriptor = mkstemp(&Temporary[0]);
+    if (Descriptor < 0) {
+        return false;
+    }
+    FILE *File = fdopen(Descriptor, "wb");
+    if (!File) {
+        close(Descriptor);
+        remove(Temporary.c_str());
+        return false;
+    }
+    bool Written = fwrite(W.Data.data(), 1, W.Data.size(), File) == W.Data.size();
+    Written = fclose(File) == 0 && Written;
+    if (!Written || rename(Temporary.c_str(), Path.c_str()) != 0) {
+        remove(Temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+//! MemoRecord/SlotRecord - A memo cache and a tier slot as read from a snapshot.
+struct MemoRecord {
+    string Function;
+    string Symbol;
+    unsigned Arity;
+    bool Current;
+    const char *Words;
+    uint64_t Bytes;
+};
+
+struct SlotRecord {
+    string Function;
+    string Symbol;
+    unsigned Generation;
+    string Optimized;
+    bool Current;
+};
+
+//! SessionImage - Everything a snapshot holds, read and checked before the session is replaced.
+struct SessionImage {
+    bool Profiled;
+    unsigned Specializations;
+    map<char, int> Precedence;
+    vector<unique_ptr<PrototypeAST>> Protos;
+    vector<unique_ptr<FunctionAST>> Defs;
+    set<string> Pure;
+    vector<MemoRecord> Caches;
+    vector<SlotRecord> Slots;
+};
+
+static bool ReadSnapshot(SnapshotReader &R, LoadedSnapshot &Snapshot, SessionImage &Image, string &Error) {
+    const char *Magic = R.readBytes(sizeof(SnapshotMagic));
+    if (!Magic || memcmp(Magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0
+        || R.read<uint32_t>() != SnapshotVersion) {
+        Error = "is not a snapshot";
+        return false;
+    }
+
+    TargetMachine &TM = TheJIT->getTargetMachine();
+    if (R.readString() != TM.getTargetTriple().str()
+        || R.readString() != TM.createDataLayout().getStringRepresentation()) {
+        Error = "is not a snapshot for this target";
+        return false;
+    }
+    string CPU = R.readString();
+    string Missing;
+    if (!HostSupports(R.readString(), Missing)) {
+        Error = "was compiled for " + CPU + " and needs the " + Missing + " feature, which this host lacks";
+        return false;
+    }
+    Image.Profiled = R.read<uint8_t>() != 0;
+    Image.Specializations = R.read<uint32_t>();
+
+    uint32_t Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        char Op = R.read<char>();
+        Image.Precedence[Op] = R.read<int32_t>();
+    }
+
+    Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        Image.Protos.push_back(ReadPrototype(R));
+        if (!Image.Protos.back()) {
+            Error = "is truncated or corrupt";
+            return false;
+        }
+    }
+
+    Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        auto Proto = ReadPrototype(R);
+        bool Memo = R.read<uint8_t>() != 0;
+        bool Pure = R.read<uint8_t>() != 0;
+        auto Body = Proto ? ReadExpr(R) : nullptr;
+        if (!Body) {
+            Error = "is truncated or corrupt";
+            return false;
+        }
+        if (Pure) {
+            Image.Pure.insert(Proto->getName());
+        }
+        Image.Defs.push_back(helper::make_unique<FunctionAST>(move(Proto), move(Body), Memo));
+    }
+
+    Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        MemoRecord Record;
+        Record.Function = R.readString();
+        Record.Symbol = R.readString();
+        Record.Arity = R.read<uint32_t>();
+        Record.Current = R.read<uint8_t>() != 0;
+        Record.Bytes = R.read<uint64_t>();
+        R.align(8);
+        Record.Words = R.readBytes(Record.Bytes);
+        Image.Caches.push_back(Record);
+    }
+
+    Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        SlotRecord Record;
+        Record.Function = R.readString();
+        Record.Symbol = R.readString();
+        Record.Generation = R.read<uint32_t>();
+        Record.Optimized = R.readString();
+        Record.Current = R.read<uint8_t>() != 0;
+        Image.Slots.push_back(Record);
+    }
+
+    Count = R.read<uint32_t>();
+    for (uint32_t i = 0; i != Count && !R.failed(); ++i) {
+        uint64_t Size = R.read<uint64_t>();
+        R.align(16);
+        const char *Bytes = R.readBytes(Size);
+        if (!Bytes) {
+            Error = "is truncated or corrupt";
+            return false;
+        }
+
+        MemoryBufferRef Ref(StringRef(Bytes, Size), Snapshot.Buffer->getBufferIdentifier());
+        auto Object = object::ObjectFile::createObjectFile(Ref);
+        if (!Object) {
+            consumeError(Object.takeError());
+            Error = "is truncated or corrupt";
+            return false;
+        }
+        Snapshot.Objects.push_back(move(*Object));
+    }
+    if (R.failed()) {
+        Error = "is truncated or corrupt";
+        return false;
+    }
+    return true;
+}
+
+//! RestoreSession - Fill the freshly initialized session with what was read from a snapshot. The runtime
+//! data the code refers to is registered first, since linking may resolve its symbols at any time.
+static void RestoreSession(LoadedSnapshot &Snapshot, SessionImage &Image) {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    BinOpPrecedence = Image.Precedence;
+    ReserveSpecializations(Image.Specializations);
+
+    for (auto &Proto : Image.Protos) {
+        string Name = Proto->getName();
+        FunctionProtos[Name] = move(Proto);
+    }
+    set<string> Names;
+    for (auto &Def : Image.Defs) {
+        string Name = Def->getProto().getName();
+        Names.insert(Name);
+        FunctionDefs[Name] = move(Def);
+    }
+    PureFunctions = Image.Pure;
+
+    for (auto &Record : Image.Caches) {
+        MemoCache &Cache = RestoreMemoCache(Record.Function, Record.Symbol, Record.Arity, Record.Current);
+        if (Record.Words && Record.Bytes == Cache.getBytes()) {
+            memcpy(Cache.getWords(), Record.Words, Record.Bytes);
+        }
+    }
+    for (auto &Record : Image.Slots) {
+        RestoreTierSlot(Record.Function, Record.Symbol, Record.Generation, Record.Optimized, Record.Current);
+    }
+    DeclareParallelRuntime();
+
+    for (auto &Object : Snapshot.Objects) {
+        if (Image.Profiled) {
+            for (auto &Name : DefinedSymbols(*Object)) {
+                DeclareProfileCounters(Name);
+            }
+        }
+        TheJIT->addObject(*Object);
+    }
+
+    RestoreDefinitions(Names);
+    PublishRestoredTierSlots();
+}
+
+bool LoadSnapshot(const string &Path) {
+    auto Buffer = MemoryBuffer::getFile(Path, -1, false);
+    if (!Buffer) {
+        fprintf(ReplOut, "LogError: Cannot read snapshot '%s'\n", Path.c_str());
+        return false;
+    }
+
+    auto Snapshot = helper::make_unique<LoadedSnapshot>();
+    Snapshot->Buffer = move(*Buffer);
+    SessionImage Image;
+    SnapshotReader R(Snapshot->Buffer->getBuffer());
+    string Error;
+    if (!ReadSnapshot(R, *Snapshot, Image, Error)) {
+        fprintf(ReplOut, "LogError: '%s' %s\n", Path.c_str(), Error.c_str());
+        return false;
+    }
+    if (Image.Profiled && !ProfilingEnabled) {
+        fprintf(ReplOut, "LogError: '%s' holds profiled code and needs --profile\n", Path.c_str());
+        return false;
+    }
+
+    ClearSession();
+    InitializeSession();
+    RestoreSession(*Snapshot, Image);
+    Snapshots.push_back(move(Snapshot));
+    return true;
+}
+
+void ResetSnapshots() {
+    Snapshots.clear();
+}
+
+void SaveSessionSnapshot() {
+    auto Start = chrono::steady_clock::now();
+    if (!SaveSnapshot(SnapshotPath)) {
+        fprintf(ReplOut, "LogError: Cannot write snapshot '%s'\n", SnapshotPath.c_str());
+        return;
+    }
+    fprintf(ReplOut, "Saved %lu definitions and %lu modules to %s in %.3f ms\n",
+            (unsigned long) FunctionDefs.size(), (unsigned long) TheJIT->getModuleCount(), SnapshotPath.c_str(),
+            chrono::duration<double>(chrono::steady_clock::now() - Start).count() * 1e3);
+}
+
+void LoadSessionSnapshot() {
+    auto Start = chrono::steady_clock::now();
+    if (LoadSnapshot(SnapshotPath)) {
+        fprintf(ReplOut, "Loaded %lu definitions and %lu modules from %s in %.3f ms\n",
+                (unsigned long) FunctionDefs.size(), (unsigned long) TheJIT->getModuleCount(), SnapshotPath.c_str(),
+                chrono::duration<double>(chrono::steady_clock::now() - Start).count() * 1e3);
+    }
+}
+
+void RestoreSessionSnapshot() {
+    if (SnapshotRestoreEnabled && sys::fs::exists(SnapshotPath)) {
+        LoadSessionSnapshot();
+    }
+}
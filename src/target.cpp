@@ -0,0 +1,126 @@
+//
+// The CPU that generated code is compiled for, and the variants of hot functions for other CPUs.
+//
+
+#include <algorithm>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/Host.h>
+
+#include "target.h"
+#include "session.h"
+
+using namespace llvm;
+
+string TargetCPU;
+string TargetFeatures;
+bool MultiversionEnabled = false;
+
+//! HostFeatures - The features of the host CPU, as far as LLVM can tell.
+static const StringMap<bool> &HostFeatures() {
+    static const StringMap<bool> Features = [] {
+        StringMap<bool> Result;
+        sys::getHostCPUFeatures(Result);
+        return Result;
+    }();
+    return Features;
+}
+
+//! SplitFeatures - The entries of a comma separated feature list.
+static vector<string> SplitFeatures(const string &Features) {
+    vector<string> Result;
+    size_t Start = 0;
+    while (Start < Features.size()) {
+        size_t End = Features.find(',', Start);
+        if (End == string::npos) {
+            End = Features.size();
+        }
+        if (End > Start) {
+            Result.push_back(Features.substr(Start, End - Start));
+        }
+        Start = End + 1;
+    }
+    return Result;
+}
+
+string GetTargetCPU() {
+    return TargetCPU.empty() ? sys::getHostCPUName().str() : TargetCPU;
+}
+
+vector<string> GetTargetAttributes() {
+    vector<string> Attributes;
+    if (TargetCPU.empty()) {
+        for (auto &Feature : HostFeatures()) {
+            Attributes.push_back((Feature.getValue() ? "+" : "-") + Feature.getKey().str());
+        }
+    }
+    for (auto &Feature : SplitFeatures(TargetFeatures)) {
+        Attributes.push_back(Feature);
+    }
+    return Attributes;
+}
+
+string GetEnabledFeatures(const MCSubtargetInfo &Subtarget) {
+    vector<string> Enabled;
+    for (auto &Feature : HostFeatures()) {
+        string Attribute = "+" + Feature.getKey().str();
+        if (Subtarget.checkFeatures(Attribute)) {
+            Enabled.push_back(Attribute);
+        }
+    }
+    for (auto &Attribute : SplitFeatures(TargetFeatures)) {
+        if (Attribute[0] == '+' && find(Enabled.begin(), Enabled.end(), Attribute) == Enabled.end()) {
+            Enabled.push_back(Attribute);
+        }
+    }
+
+    string Features;
+    for (auto &Attribute : Enabled) {
+        Features += (Features.empty() ? "" : ",") + Attribute;
+    }
+    return Features;
+}
+
+const vector<CodeVariant> &GetCodeVariants() {
+    static const vector<CodeVariant> None;
+    static const vector<CodeVariant> X86 = {
+            {"avx512", "skylake-avx512", "+avx512f,+avx512dq,+avx512bw,+avx512vl,+avx2,+fma"},
+            {"avx2", "haswell", "+avx2,+fma,+bmi2"},
+    };
+    return Triple(sys::getProcessTriple()).getArch() == Triple::x86_64 ? X86 : None;
+}
+
+bool HostSupports(const string &Features, string &Missing) {
+    for (auto &Feature : SplitFeatures(Features)) {
+        if (Feature[0] != '+') {
+            continue;
+        }
+        auto Host = HostFeatures().find(Feature.substr(1));
+        if (Host == HostFeatures().end() || !Host->getValue()) {
+            Missing = Feature.substr(1);
+            return false;
+        }
+    }
+    return true;
+}
+
+void PrintTargetInfo() {
+    fprintf(ReplOut, "target: %s, cpu %s%s\n", sys::getProcessTriple().c_str(), GetTargetCPU().c_str(),
+            TargetCPU.empty() ? " (host)" : "");
+
+    string Enabled;
+    for (auto &Attribute : GetTargetAttributes()) {
+        if (Attribute[0] == '+') {
+            Enabled += " " + Attribute.substr(1);
+        }
+    }
+    fprintf(ReplOut, "  features:%s\n", Enabled.empty() ? " (cpu defaults)" : Enabled.c_str());
+
+    fprintf(ReplOut, "  multiversioning %s", MultiversionEnabled ? "enabled" : "disabled");
+    for (auto &Variant : GetCodeVariants()) {
+        string Missing;
+        fprintf(ReplOut, ", %s %s", Variant.Name,
+                HostSupports(Variant.Features, Missing) ? "runs here" : ("needs " + Missing).c_str());
+    }
+    fprintf(ReplOut, "\n");
+}
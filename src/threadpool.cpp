@@ -0,0 +1,150 @@
+//
+// A work-stealing thread pool for the parallel builtins.
+//
+
+#include "threadpool.h"
+#include "helper.h"
+
+unsigned ParallelThreads = 0;
+
+//! The index of the queue owned by the current thread, if it is a worker of some pool.
+static thread_local int WorkerQueue = -1;
+
+//! ChunksPerThread - How many chunks each thread gets on average; more chunks balance better,
+//! fewer chunks have less scheduling overhead.
+static const int64_t ChunksPerThread = 8;
+
+WorkStealingPool::WorkStealingPool(unsigned Parallelism) : QueuedTasks(0), Stopping(false) {
+    unsigned WorkerCount = Parallelism > 1 ? Parallelism - 1 : 0;
+
+    // One queue per worker, plus the shared one for outside threads.
+    for (unsigned i = 0; i <= WorkerCount; ++i) {
+        Queues.push_back(helper::make_unique<TaskQueue>());
+    }
+    for (unsigned i = 0; i < WorkerCount; ++i) {
+        Workers.push_back(thread(&WorkStealingPool::runWorker, this, i));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> Lock(SleepMutex);
+        Stopping = true;
+    }
+    SleepCondition.notify_all();
+    for (auto &Worker : Workers) {
+        Worker.join();
+    }
+}
+
+unsigned WorkStealingPool::currentQueue() const {
+    return WorkerQueue >= 0 ? static_cast<unsigned>(WorkerQueue) : static_cast<unsigned>(Workers.size());
+}
+
+bool WorkStealingPool::popTask(unsigned Index, Task &Result) {
+    TaskQueue &Queue = *Queues[Index];
+    lock_guard<mutex> Lock(Queue.Mutex);
+    if (Queue.Tasks.empty()) {
+        return false;
+    }
+    Result = Queue.Tasks.back();
+    Queue.Tasks.pop_back();
+    --QueuedTasks;
+    return true;
+}
+
+bool WorkStealingPool::stealTask(unsigned Index, Task &Result) {
+    for (size_t i = 1; i < Queues.size(); ++i) {
+        TaskQueue &Victim = *Queues[(Index + i) % Queues.size()];
+        lock_guard<mutex> Lock(Victim.Mutex);
+        if (!Victim.Tasks.empty()) {
+            Result = Victim.Tasks.front();
+            Victim.Tasks.pop_front();
+            --QueuedTasks;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkStealingPool::findTask(unsigned Index, Task &Result) {
+    return popTask(Index, Result) || stealTask(Index, Result);
+}
+
+void WorkStealingPool::runTask(const Task &T) {
+    T.Owner->Results[T.Index] = (*T.Owner->Chunk)(T.Begin, T.End);
+    T.Owner->Remaining.fetch_sub(1, memory_order_release);
+}
+
+void WorkStealingPool::runWorker(unsigned Index) {
+    WorkerQueue = static_cast<int>(Index);
+    while (true) {
+        Task T;
+        if (findTask(Index, T)) {
+            runTask(T);
+            continue;
+        }
+
+        unique_lock<mutex> Lock(SleepMutex);
+        SleepCondition.wait(Lock, [this] { return Stopping || QueuedTasks > 0; });
+        if (Stopping) {
+            return;
+        }
+    }
+}
+
+double WorkStealingPool::parallelReduce(int64_t Lo, int64_t Hi, const ChunkFn &Chunk, const CombineFn &Combine) {
+    if (Hi <= Lo) {
+        return 0;
+    }
+
+    int64_t Count = Hi - Lo;
+    int64_t ChunkCount = min<int64_t>(Count, ChunksPerThread * getParallelism());
+    int64_t ChunkSize = (Count + ChunkCount - 1) / ChunkCount;
+    ChunkCount = (Count + ChunkSize - 1) / ChunkSize;
+
+    Job J;
+    J.Chunk = &Chunk;
+    J.Results.resize(static_cast<size_t>(ChunkCount));
+    J.Remaining = static_cast<size_t>(ChunkCount);
+
+    // Deal the chunks out round-robin, so that every worker starts with local work.
+    for (int64_t i = 0; i < ChunkCount; ++i) {
+        Task T;
+        T.Owner = &J;
+        T.Begin = Lo + i * ChunkSize;
+        T.End = min(Hi, T.Begin + ChunkSize);
+        T.Index = static_cast<size_t>(i);
+
+        TaskQueue &Queue = *Queues[static_cast<size_t>(i) % Queues.size()];
+        lock_guard<mutex> Lock(Queue.Mutex);
+        Queue.Tasks.push_back(T);
+        ++QueuedTasks;
+    }
+    {
+        lock_guard<mutex> Lock(SleepMutex);
+    }
+    SleepCondition.notify_all();
+
+    // Help out until all chunks of this job are done.
+    unsigned Index = currentQueue();
+    while (J.Remaining.load(memory_order_acquire) != 0) {
+        Task T;
+        if (findTask(Index, T)) {
+            runTask(T);
+        } else {
+            this_thread::yield();
+        }
+    }
+
+    double Result = J.Results[0];
+    for (size_t i = 1; i < J.Results.size(); ++i) {
+        Result = Combine(Result, J.Results[i]);
+    }
+    return Result;
+}
+
+WorkStealingPool &GetThreadPool() {
+    static WorkStealingPool Pool(ParallelThreads ? ParallelThreads : max(1u, thread::hardware_concurrency()));
+    return Pool;
+}
@@ -0,0 +1,514 @@
+//
+// Profile-guided tiered recompilation of hot definitions.
+//
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "tiered.h"
+#include "analysis.h"
+#include "codegen.h"
+#include "optimizer.h"
+#include "peval.h"
+#include "jit.h"
+#include "session.h"
+#include "target.h"
+#include "helper.h"
+
+bool TieredCompilationEnabled = false;
+uint64_t TierUpThreshold = 1000;
+
+thread_local map<string, string> CallRedirects;
+
+//! TierSlots - Owns every slot ever created, keyed by symbol. Slots of superseded definitions
+//! stay alive as long as code compiled against them keeps calling through them.
+static thread_local map<string, unique_ptr<TierSlot>> TierSlots;
+static thread_local map<string, TierSlot *> CurrentTierSlots;
+static thread_local map<string, TierSlot *> PendingTierSlots;
+static thread_local vector<TierSlot *> RestoredTierSlots;
+
+//! TierGeneration - Numbers the slot symbols, process-wide so that they are unique across sessions.
+static atomic<unsigned> TierGeneration(0);
+
+//! Tier-ups that were triggered on a thread other than the slot's owner.
+static mutex PendingTierUpsMutex;
+static vector<TierSlot *> PendingTierUps;
+
+//! TierSession - The JIT of a session and the mutex guarding it, as seen by the background compiler.
+//! A session that goes away closes it, so that its queued jobs are dropped instead of run.
+struct TierSession {
+    KaleidoscopeJIT *JIT;
+    recursive_mutex *Mutex;
+    bool Closed;
+};
+
+static thread_local shared_ptr<TierSession> CurrentTierSession;
+
+//! TierUpJob - A recompiled module waiting to be optimized and linked by the background compiler.
+struct TierUpJob {
+    unique_ptr<Module> M;
+    TierSlot *Slot;
+    string Symbol;
+    shared_ptr<TierSession> Session;
+};
+
+static mutex QueueMutex;
+static condition_variable QueueCondition;
+static deque<TierUpJob> Queue;
+static thread Worker;
+static bool ShuttingDown = false;
+
+static Constant *DeclareSlot(Module *M, TierSlot &Slot) {
+    LLVMContext &Context = M->getContext();
+    StructType *SlotTy = StructType::get(Context, {Type::getInt8PtrTy(Context), Type::getInt64Ty(Context)});
+    return M->getOrInsertGlobal(Slot.Symbol, SlotTy);
+}
+
+TierSlot *CreateTierSlot(const string &Function) {
+    auto Slot = helper::make_unique<TierSlot>();
+    Slot->Data.Target = nullptr;
+    Slot->Data.Calls = 0;
+    Slot->Data.Slot = Slot.get();
+    Slot->Function = Function;
+    Slot->Generation = ++TierGeneration;
+    Slot->Symbol = "__tier." + Function + "." + to_string(Slot->Generation);
+    Slot->Tier = TierSlot::Baseline;
+    Slot->Owner = this_thread::get_id();
+
+    TheJIT->addRuntimeSymbol(Slot->Symbol, &Slot->Data);
+    TierSlot *Result = Slot.get();
+    PendingTierSlots[Function] = Result;
+    TierSlots[Result->Symbol] = move(Slot);
+    return Result;
+}
+
+//! Tier0Symbol - The name under which the tier 0 code of a slot's definition is also linked, so that the
+//! slot can keep exactly that code alive, not just the newest definition of the function.
+static string Tier0Symbol(const TierSlot &Slot) {
+    return Slot.Function + ".tier0." + to_string(Slot.Generation);
+}
+
+void SkipTierSlot(const string &Function) {
+    PendingTierSlots[Function] = nullptr;
+}
+
+void PublishTierSlot(const string &Function) {
+    auto Pending = PendingTierSlots.find(Function);
+    TierSlot *Slot = Pending != PendingTierSlots.end() ? Pending->second : nullptr;
+    if (Pending != PendingTierSlots.end()) {
+        PendingTierSlots.erase(Pending);
+    }
+
+    // The slot of the superseded definition must not be used by new callers, nor tiered up.
+    if (!Slot) {
+        CurrentTierSlots.erase(Function);
+        return;
+    }
+
+    auto Symbol = TheJIT->findSymbol(Function);
+    assert(Symbol && "Tier 0 function not found");
+    __atomic_store_n(&Slot->Data.Target, (void *) (intptr_t) Symbol.getAddress(), __ATOMIC_RELEASE);
+    TheJIT->addSymbolReference(Slot->Symbol, Tier0Symbol(*Slot));
+    CurrentTierSlots[Function] = Slot;
+}
+
+void DiscardTierSlot(const string &Function) {
+    PendingTierSlots.erase(Function);
+}
+
+TierSlot *FindTierSlot(const string &Function) {
+    auto Pending = PendingTierSlots.find(Function);
+    if (Pending != PendingTierSlots.end()) {
+        return Pending->second;
+    }
+
+    auto Current = CurrentTierSlots.find(Function);
+    return Current != CurrentTierSlots.end() ? Current->second : nullptr;
+}
+
+//! chickadee_tier_up - Called by tier 0 code when its function crosses the hotness threshold.
+extern "C" void chickadee_tier_up(TierSlotData *Data);
+
+//! FindOptimizedCode - The optimized code of a function: the best variant of it that the host can run, if it
+//! was multiversioned, or the function itself.
+static JITSymbol FindOptimizedCode(KaleidoscopeJIT &JIT, const string &Symbol) {
+    for (auto &Variant : GetCodeVariants()) {
+        string Missing;
+        if (!HostSupports(Variant.Features, Missing)) {
+            continue;
+        }
+        if (auto Code = JIT.findSymbol(Symbol + "." + Variant.Name)) {
+            return Code;
+        }
+    }
+    return JIT.findSymbol(Symbol);
+}
+
+vector<const TierSlot *> GetTierSlots() {
+    vector<const TierSlot *> Slots;
+    for (auto &Entry : TierSlots) {
+        Slots.push_back(Entry.second.get());
+    }
+    return Slots;
+}
+
+void RestoreTierSlot(const string &Function, const string &Symbol, unsigned Generation, const string &Optimized,
+                     bool Current) {
+    auto Slot = helper::make_unique<TierSlot>();
+    Slot->Data.Target = nullptr;
+    Slot->Data.Calls = 0;
+    Slot->Data.Slot = Slot.get();
+    Slot->Function = Function;
+    Slot->Generation = Generation;
+    Slot->Symbol = Symbol;
+    Slot->OptimizedSymbol = Optimized;
+    Slot->Tier = Optimized.empty() ? TierSlot::Baseline : TierSlot::Optimized;
+    Slot->Owner = this_thread::get_id();
+
+    // Slots created from now on must not reuse the symbol.
+    unsigned Newest = TierGeneration;
+    while (Newest < Generation && !TierGeneration.compare_exchange_weak(Newest, Generation)) {
+    }
+
+    TheJIT->addRuntimeSymbol(Slot->Symbol, &Slot->Data);
+    TheJIT->addRuntimeSymbol("chickadee_tier_up", (void *) &chickadee_tier_up);
+    if (Current) {
+        CurrentTierSlots[Function] = Slot.get();
+    }
+    RestoredTierSlots.push_back(Slot.get());
+    TierSlots[Symbol] = move(Slot);
+}
+
+void PublishRestoredTierSlots() {
+    for (TierSlot *Slot : RestoredTierSlots) {
+        bool Optimized = Slot->Tier == TierSlot::Optimized;
+        auto Symbol = Optimized ? FindOptimizedCode(*TheJIT, Slot->OptimizedSymbol)
+                                : TheJIT->findSymbol(Slot->Function);
+        assert(Symbol && "Restored tier code not found");
+        __atomic_store_n(&Slot->Data.Target, (void *) (intptr_t) Symbol.getAddress(), __ATOMIC_RELEASE);
+        TheJIT->addSymbolReference(Slot->Symbol, Optimized ? Slot->OptimizedSymbol : Tier0Symbol(*Slot));
+    }
+    RestoredTierSlots.clear();
+}
+
+BasicBlock *EmitTierUpCheck(Function *F, TierSlot &Slot) {
+    LLVMContext &Context = F->getContext();
+    Module *M = F->getParent();
+
+    BasicBlock *Entry = BasicBlock::Create(Context, "entry", F);
+    BasicBlock *TierUp = BasicBlock::Create(Context, "tierup", F);
+    BasicBlock *Body = BasicBlock::Create(Context, "body", F);
+    IRBuilder<> B(Entry);
+
+    Constant *SlotPtr = DeclareSlot(M, Slot);
+    Value *Calls = B.CreateAtomicRMW(AtomicRMWInst::Add, B.CreateStructGEP(nullptr, SlotPtr, 1), B.getInt64(1),
+                                     AtomicOrdering::Monotonic);
+    B.CreateCondBr(B.CreateICmpEQ(Calls, B.getInt64(TierUpThreshold - 1), "hot"), TierUp, Body);
+
+    B.SetInsertPoint(TierUp);
+    FunctionType *CallbackTy = FunctionType::get(Type::getVoidTy(Context), {SlotPtr->getType()}, false);
+    TheJIT->addRuntimeSymbol("chickadee_tier_up", (void *) &chickadee_tier_up);
+    B.CreateCall(M->getOrInsertFunction("chickadee_tier_up", CallbackTy), {SlotPtr});
+    B.CreateBr(Body);
+
+    return Body;
+}
+
+void EmitTier0Alias(Function *F, TierSlot &Slot) {
+    GlobalAlias::create(Tier0Symbol(Slot), F);
+}
+
+Value *EmitSlotTarget(IRBuilder<> &Builder, TierSlot &Slot) {
+    Constant *SlotPtr = DeclareSlot(Builder.GetInsertBlock()->getModule(), Slot);
+
+    LoadInst *Target = Builder.CreateLoad(Builder.CreateStructGEP(nullptr, SlotPtr, 0), "target");
+    Target->setAtomic(AtomicOrdering::Acquire);
+    Target->setAlignment(8);
+    return Target;
+}
+
+Value *EmitSlotCall(IRBuilder<> &Builder, TierSlot &Slot, Function *Callee, ArrayRef<Value *> Args) {
+    Value *Fn = Builder.CreateBitCast(EmitSlotTarget(Builder, Slot), Callee->getFunctionType()->getPointerTo());
+    return Builder.CreateCall(Fn, Args, "calltmp");
+}
+
+//! OptimizeModule - The full optimization pipeline for hot code, including the inliner. The vectorizers
+//! see the vector registers of the target CPU, or of the CPU a multiversioned function was cloned for.
+static void OptimizeModule(Module &M, TargetMachine &TM) {
+    legacy::FunctionPassManager FPM(&M);
+    legacy::PassManager MPM;
+    FPM.add(createTargetTransformInfoWrapperPass(TM.getTargetIRAnalysis()));
+    MPM.add(createTargetTransformInfoWrapperPass(TM.getTargetIRAnalysis()));
+
+    PassManagerBuilder Builder;
+    Builder.OptLevel = 3;
+    Builder.Inliner = createFunctionInliningPass(3, 0);
+    Builder.LoopVectorize = true;
+    Builder.SLPVectorize = true;
+    Builder.populateFunctionPassManager(FPM);
+    Builder.populateModulePassManager(MPM);
+
+    FPM.doInitialization();
+    for (auto &F : M) {
+        FPM.run(F);
+    }
+    FPM.doFinalization();
+    MPM.run(M);
+}
+
+static void RunWorker() {
+    while (true) {
+        TierUpJob Job;
+        {
+            unique_lock<mutex> Lock(QueueMutex);
+            QueueCondition.wait(Lock, [] { return ShuttingDown || !Queue.empty(); });
+            if (ShuttingDown) {
+                return;
+            }
+            Job = move(Queue.front());
+            Queue.pop_front();
+        }
+
+        // The JIT and the LLVM context are shared with the thread that owns the slot.
+        lock_guard<recursive_mutex> Lock(*Job.Session->Mutex);
+        if (Job.Session->Closed) {
+            Job.M.reset();
+            continue;
+        }
+        --Job.Slot->Jobs;
+        OptimizeModule(*Job.M, Job.Session->JIT->getTargetMachine());
+        Job.Session->JIT->addModule(move(Job.M));
+
+        // The optimized code is only reachable through the slot, which the code does not show.
+        Job.Session->JIT->addSymbolReference(Job.Slot->Symbol, Job.Symbol);
+
+        auto Symbol = FindOptimizedCode(*Job.Session->JIT, Job.Symbol);
+        if (Symbol) {
+            __atomic_store_n(&Job.Slot->Data.Target, (void *) (intptr_t) Symbol.getAddress(), __ATOMIC_RELEASE);
+            Job.Slot->OptimizedSymbol = Job.Symbol;
+            Job.Slot->Tier = TierSlot::Optimized;
+        }
+    }
+}
+
+//! EmitCodeVariants - Clone the optimized function F once for every CPU in GetCodeVariants, each clone named
+//! after its variant and compiled for that CPU. Recursive calls stay within the clone.
+static void EmitCodeVariants(Function *F) {
+    for (auto &Variant : GetCodeVariants()) {
+        ValueToValueMapTy VMap;
+        Function *Clone = CloneFunction(F, VMap);
+        Clone->setName(F->getName() + "." + Variant.Name);
+        Clone->addFnAttr("target-cpu", Variant.CPU);
+        Clone->addFnAttr("target-features", Variant.Features);
+
+        vector<Use *> RecursiveCalls;
+        for (auto &U : F->uses()) {
+            auto *Call = dyn_cast<CallInst>(U.getUser());
+            if (Call && Call->getParent()->getParent() == Clone) {
+                RecursiveCalls.push_back(&U);
+            }
+        }
+        for (Use *U : RecursiveCalls) {
+            U->set(Clone);
+        }
+    }
+}
+
+static void Enqueue(TierUpJob Job) {
+    lock_guard<mutex> Lock(QueueMutex);
+    if (!Worker.joinable()) {
+        Worker = thread(RunWorker);
+    }
+    Queue.push_back(move(Job));
+    QueueCondition.notify_one();
+}
+
+//! TierUp - Generate the optimized version of a hot function and hand it to the background compiler.
+//! The profile decides which callees get a local copy for the inliner: those that are hot themselves.
+static void TierUp(TierSlot &Slot) {
+    auto Current = CurrentTierSlots.find(Slot.Function);
+    auto Def = FunctionDefs.find(Slot.Function);
+    if (Current == CurrentTierSlots.end() || Current->second != &Slot || Def == FunctionDefs.end()
+        || Slot.Tier != TierSlot::Baseline) {
+        return;
+    }
+    Slot.Tier = TierSlot::Queued;
+
+    auto Evaluated = PartiallyEvaluate(*Def->second);
+    FunctionAST &Source = Evaluated ? *Evaluated : *Def->second;
+
+    auto SavedModule = move(TheModule);
+    auto SavedFPM = move(TheFPM);
+    InitializeModuleAndPassManager();
+
+    set<string> Callees;
+    collectCallees(Source.getBody(), Callees);
+    for (auto &Callee : Callees) {
+        auto CalleeSlot = CurrentTierSlots.find(Callee);
+        auto CalleeDef = FunctionDefs.find(Callee);
+        if (Callee == Slot.Function || CalleeSlot == CurrentTierSlots.end() || CalleeDef == FunctionDefs.end()) {
+            continue;
+        }
+
+        uint64_t Calls = __atomic_load_n(&CalleeSlot->second->Data.Calls, __ATOMIC_RELAXED);
+        if (Calls < TierUpThreshold) {
+            continue;
+        }
+        if (Function *Copy = CalleeDef->second->codegenClone(Callee + ".inl", Function::InternalLinkage)) {
+            Copy->setEntryCount(Calls);
+            CallRedirects[Callee] = Copy->getName();
+        }
+    }
+
+    // Recursive calls go straight to the optimized code.
+    string Name = Slot.Function + ".tier1." + to_string(Slot.Generation);
+    CallRedirects[Slot.Function] = Name;
+    Function *F = Source.codegenClone(Name, Function::ExternalLinkage);
+    CallRedirects.clear();
+    if (F) {
+        F->setEntryCount(__atomic_load_n(&Slot.Data.Calls, __ATOMIC_RELAXED));
+        if (MultiversionEnabled) {
+            EmitCodeVariants(F);
+        }
+    }
+
+    auto M = move(TheModule);
+    TheModule = move(SavedModule);
+    TheFPM = move(SavedFPM);
+
+    if (!F) {
+        Slot.Tier = TierSlot::Baseline;
+        return;
+    }
+
+    TierUpJob Job;
+    Job.M = move(M);
+    Job.Slot = &Slot;
+    Job.Symbol = Name;
+    if (!CurrentTierSession) {
+        CurrentTierSession = make_shared<TierSession>(TierSession{TheJIT.get(), &CompileMutex, false});
+    }
+    Job.Session = CurrentTierSession;
+    ++Slot.Jobs;
+    Enqueue(move(Job));
+}
+
+extern "C" void chickadee_tier_up(TierSlotData *Data) {
+    TierSlot &Slot = *Data->Slot;
+    if (this_thread::get_id() != Slot.Owner) {
+        lock_guard<mutex> Lock(PendingTierUpsMutex);
+        PendingTierUps.push_back(&Slot);
+        return;
+    }
+
+    // The owning thread is running JIT'd code, so no code generation is in progress and the
+    // IR for the optimized version can be generated right away.
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    TierUp(Slot);
+}
+
+//! TakePendingTierUps - Remove the pending tier-ups of the slots owned by the current thread.
+static vector<TierSlot *> TakePendingTierUps() {
+    lock_guard<mutex> Lock(PendingTierUpsMutex);
+    vector<TierSlot *> Slots;
+    auto Others = partition(PendingTierUps.begin(), PendingTierUps.end(), [](TierSlot *Slot) {
+        return Slot->Owner != this_thread::get_id();
+    });
+    Slots.assign(Others, PendingTierUps.end());
+    PendingTierUps.erase(Others, PendingTierUps.end());
+    return Slots;
+}
+
+void ProcessPendingTierUps() {
+    vector<TierSlot *> Slots = TakePendingTierUps();
+
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    for (TierSlot *Slot : Slots) {
+        TierUp(*Slot);
+    }
+}
+
+//! isTierUpPending - Whether a tier-up of Slot that was triggered on another thread is still waiting.
+static bool isTierUpPending(const TierSlot *Slot) {
+    lock_guard<mutex> Lock(PendingTierUpsMutex);
+    return find(PendingTierUps.begin(), PendingTierUps.end(), Slot) != PendingTierUps.end();
+}
+
+unsigned CollectTierSlots(uint64_t &Bytes) {
+    unsigned Collected = 0;
+    for (auto Entry = TierSlots.begin(); Entry != TierSlots.end();) {
+        TierSlot *Slot = Entry->second.get();
+        auto Current = CurrentTierSlots.find(Slot->Function);
+        auto Pending = PendingTierSlots.find(Slot->Function);
+        if ((Current != CurrentTierSlots.end() && Current->second == Slot)
+            || (Pending != PendingTierSlots.end() && Pending->second == Slot) || Slot->Jobs != 0
+            || find(RestoredTierSlots.begin(), RestoredTierSlots.end(), Slot) != RestoredTierSlots.end()
+            || TheJIT->isSymbolReferenced(Entry->first) || isTierUpPending(Slot)) {
+            ++Entry;
+            continue;
+        }
+        TheJIT->removeRuntimeSymbol(Entry->first);
+        Bytes += sizeof(TierSlot);
+        ++Collected;
+        Entry = TierSlots.erase(Entry);
+    }
+    return Collected;
+}
+
+void GetTierSlotUsage(size_t &Slots, uint64_t &Bytes) {
+    Slots = TierSlots.size();
+    Bytes = Slots * sizeof(TierSlot);
+}
+
+void ShutdownTieredCompilation() {
+    {
+        lock_guard<mutex> Lock(QueueMutex);
+        ShuttingDown = true;
+        QueueCondition.notify_all();
+    }
+    if (Worker.joinable()) {
+        Worker.join();
+    }
+    Queue.clear();
+}
+
+void ResetTieredCompilation() {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    if (CurrentTierSession) {
+        CurrentTierSession->Closed = true;
+        CurrentTierSession.reset();
+    }
+    TakePendingTierUps();
+
+    CallRedirects.clear();
+    PendingTierSlots.clear();
+    RestoredTierSlots.clear();
+    CurrentTierSlots.clear();
+    TierSlots.clear();
+}
+
+void PrintTierStats() {
+    if (CurrentTierSlots.empty()) {
+        fprintf(ReplOut, "No tiered functions.\n");
+        return;
+    }
+
+    static const char *TierNames[] = {"tier 0", "tier 0, recompiling", "tier 1"};
+    for (auto &Entry : CurrentTierSlots) {
+        TierSlot &Slot = *Entry.second;
+        fprintf(ReplOut, "%s: %llu calls, %s\n",
+                Entry.first.c_str(),
+                (unsigned long long) __atomic_load_n(&Slot.Data.Calls, __ATOMIC_RELAXED),
+                TierNames[Slot.Tier]);
+    }
+}
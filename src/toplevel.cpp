@@ -8,15 +8,160 @@
 #include "toplevel.h"
 #include "optimizer.h"
 #include "jit.h"
+#include "memo.h"
+#include "peval.h"
+#include "tiered.h"
+#include "depgraph.h"
+#include "hashcons.h"
+#include "profile.h"
+#include "simd.h"
+#include "autodiff.h"
+#include "gc.h"
+#include "snapshot.h"
+#include "target.h"
+#include "session.h"
+
+#include <map>
+#include <string>
+
+void CompileDefinition(unique_ptr<FunctionAST> FnAST) {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+
+    // Specializations may have folded calls to the function that is being redefined.
+    InvalidateSpecializations(FnAST->getProto().getName());
+
+    auto Evaluated = PartiallyEvaluate(*FnAST);
+    if (auto *FnIR = (Evaluated ? Evaluated : FnAST)->codegen(TieredCompilationEnabled)) {
+        fprintf(ReplOut, "Read function definition:");
+        PrintIR(*FnIR);
+        TheJIT->addModule(std::move(TheModule));
+        InitializeModuleAndPassManager();
+
+        string Name = FnAST->getProto().getName();
+        PublishTierSlot(Name);
+        FunctionDefs[Name] = move(FnAST);
+        UpdateDefinition(Name);
+
+        // The superseded code and whatever only it used can go now.
+        CollectGarbage();
+    }
+}
+
+void CompileExtern(unique_ptr<PrototypeAST> ProtoAST) {
+    lock_guard<recursive_mutex> Lock(CompileMutex);
+    if (auto *FnIR = ProtoAST->codegen()) {
+        fprintf(ReplOut, "Read extern: ");
+        PrintIR(*FnIR);
+        FunctionProtos[ProtoAST->getName()] = move(ProtoAST);
+    }
+}
+
+void EvaluateTopLevelExpression(unique_ptr<FunctionAST> FnAST) {
+    unique_lock<recursive_mutex> Lock(CompileMutex);
+    auto Evaluated = PartiallyEvaluate(*FnAST);
+
+    // Expressions that fold to a constant need not be compiled at all.
+    if (Evaluated) {
+        if (auto *Folded = dyn_cast<NumberExprAST>(&Evaluated->getBody())) {
+            fprintf(ReplOut, "Evaluated to %f\n", Folded->getValue());
+            return;
+        }
+    }
+
+    if (auto *FnIR = (Evaluated ? Evaluated : FnAST)->codegen()) {
+        // Vector results are not returned to the host directly, but stored through a pointer.
+        unsigned Lanes = getLaneCount(FnIR->getReturnType());
+        if (Lanes > 1) {
+            EmitLaneStore(FnIR, "__anon_expr.lanes");
+        }
+
+        // gradient(...) leaves the partial derivatives in a global of the module.
+        unsigned Partials = 0;
+        if (auto *Gradient = TheModule->getNamedGlobal(GradientSymbol)) {
+            Partials = static_cast<unsigned>(Gradient->getValueType()->getArrayNumElements());
+        }
+
+        // JIT the module containing the anonymous expression, keeping a handle so
+        // we can free it later.
+        auto H = TheJIT->addModule(move(TheModule));
+        InitializeModuleAndPassManager();
+
+        if (Lanes > 1) {
+            auto StoreSymbol = TheJIT->findSymbol("__anon_expr.lanes");
+            assert(StoreSymbol && "Function not found");
+
+            double Result[4];
+            void (*Store)(double *) = (void (*)(double *))(intptr_t)StoreSymbol.getAddress();
+            Lock.unlock();
+            Store(Result);
+            Lock.lock();
+
+            fprintf(ReplOut, "Evaluated to <");
+            for (unsigned i = 0; i != Lanes; ++i) {
+                fprintf(ReplOut, i ? ", %f" : "%f", Result[i]);
+            }
+            fprintf(ReplOut, ">\n");
+            TheJIT->removeModule(H);
+            return;
+        }
+
+        // Search the JIT for the __anon_expr symbol.
+        auto ExprSymbol = TheJIT->findSymbol("__anon_expr");
+        assert(ExprSymbol && "Function not found");
+
+        // Get the symbol's address and cast it to the right type (takes no
+        // arguments, returns a double) so we can call it as a native function.
+        // The background compiler may link hot code while the expression runs.
+        double (*FP)() = (double (*)())(intptr_t)ExprSymbol.getAddress();
+        Lock.unlock();
+        double Result = FP();
+        Lock.lock();
+        if (Partials) {
+            auto StoredSymbol = TheJIT->findSymbol(GradientSymbol);
+            assert(StoredSymbol && "Gradient not found");
+
+            const double *Gradient = (const double *) (intptr_t) StoredSymbol.getAddress();
+            fprintf(ReplOut, "Evaluated to %f with gradient <", Result);
+            for (unsigned i = 0; i != Partials; ++i) {
+                fprintf(ReplOut, i ? ", %f" : "%f", Gradient[i]);
+            }
+            fprintf(ReplOut, ">\n");
+        } else {
+            fprintf(ReplOut, "Evaluated to %f\n", Result);
+        }
+
+        // Delete the anonymous expression module from the JIT.
+        TheJIT->removeModule(H);
+
+    }
+}
+
+//! Commands - The REPL commands that can be issued as ':name', e.g. ':memo'.
+static const map<string, void (*)()> Commands = {
+        {"memo", PrintMemoStats},
+        {"peval", PrintPartialEvalStats},
+        {"tiers", PrintTierStats},
+        {"deps", PrintDependencies},
+        {"codegen", PrintCodegenStats},
+        {"profile", PrintProfile},
+        {"memory", PrintMemoryStats},
+        {"save", SaveSessionSnapshot},
+        {"load", LoadSessionSnapshot},
+        {"target", PrintTargetInfo},
+};
+
+void RunCommand(const string &Name) {
+    auto Command = Commands.find(Name);
+    if (Command == Commands.end()) {
+        fprintf(ReplOut, "LogError: Unknown command ':%s'\n", Name.c_str());
+    } else {
+        Command->second();
+    }
+}
 
 static void HandleDefinition() {
     if (auto FnAST = ParseDefinition()) {
-        if (auto *FnIR = FnAST->codegen()) {
-            fprintf(stderr, "Read function definition:");
-            FnIR->dump();
-            TheJIT->addModule(std::move(TheModule));
-            InitializeModuleAndPassManager();
-        }
+        CompileDefinition(move(FnAST));
     } else {
         // Skip token for error recovery.
         getNextToken();
@@ -25,11 +170,7 @@ static void HandleDefinition() {
 
 static void HandleExtern() {
     if (auto ProtoAST = ParseExtern()) {
-        if (auto *FnIR = ProtoAST->codegen()) {
-            fprintf(stderr, "Read extern: ");
-            FnIR->dump();
-            FunctionProtos[ProtoAST->getName()] = move(ProtoAST);
-        }
+        CompileExtern(move(ProtoAST));
     } else {
         // Skip token for error recovery.
         getNextToken();
@@ -39,36 +180,37 @@ static void HandleExtern() {
 static void HandleTopLevelExpression() {
     // Evaluate a top-level expression into an anonymous function.
     if (auto FnAST = ParseTopLevelExpr()) {
-        if (FnAST->codegen()) {
-
-            // JIT the module containing the anonymous expression, keeping a handle so
-            // we can free it later.
-            auto H = TheJIT->addModule(move(TheModule));
-            InitializeModuleAndPassManager();
-
-            // Search the JIT for the __anon_expr symbol.
-            auto ExprSymbol = TheJIT->findSymbol("__anon_expr");
-            assert(ExprSymbol && "Function not found");
-
-            // Get the symbol's address and cast it to the right type (takes no
-            // arguments, returns a double) so we can call it as a native function.
-            double (*FP)() = (double (*)())(intptr_t)ExprSymbol.getAddress();
-            fprintf(stderr, "Evaluated to %f\n", FP());
-
-            // Delete the anonymous expression module from the JIT.
-            TheJIT->removeModule(H);
-
-        }
+        EvaluateTopLevelExpression(move(FnAST));
     } else {
         // Skip token for error recovery.
         getNextToken();
     }
 }
 
-//! top ::= definition | external | expression | ';'
+//! command ::= ':' identifier
+static void HandleCommand() {
+    getNextToken();  // eat ':'.
+    if (CurTok != static_cast<int>(Token::Identifier)) {
+        fprintf(ReplOut, "LogError: Expected command name after ':'\n");
+        return;
+    }
+
+    // Run the command before eating its name, so that its output is not held back
+    // until the next token has been typed.
+    RunCommand(getTokenText());
+    getNextToken();  // eat the command name.
+}
+
+//! top ::= definition | external | expression | command | ';'
 void MainLoop() {
     while (1) {
-        fprintf(stderr, "ready> ");
+        // Between items is a safe point for tier-ups requested by other threads,
+        // and no tokens before the current one are needed anymore.
+        ProcessPendingTierUps();
+        compactTokens();
+
+        fprintf(ReplOut, "ready> ");
+        fflush(ReplOut);
         switch (CurTok) {
             case static_cast<int>(Token::EndOfFile): {
                 return;
@@ -85,6 +227,10 @@ void MainLoop() {
                 HandleExtern();
                 break;
             }
+            case ':': {
+                HandleCommand();
+                break;
+            }
             default: {
                 HandleTopLevelExpression();
                 break;
@@ -0,0 +1,205 @@
+//
+// Load generator for the evaluation server: drives concurrent sessions and reports latency and throughput.
+//
+// Usage: chickadee-loadgen <socket> [-c clients] [-n requests per client] [-s setup] [-e expression]
+//
+// Every client connects, sends the setup line (by default a definition; pass -s "" when it comes from
+// the server's prelude), and then sends its requests one at a time, waiting for each result. A '%d'
+// in the expression is replaced by the request number, so that results cannot simply be cached. The
+// requests are constant expressions, so run the server with --no-peval to measure JIT'd code rather
+// than partial evaluation.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct ClientResult {
+    bool Ok = true;
+    double SetupSeconds = 0;
+    vector<double> Latencies;
+};
+
+//! Connection - A client connection that reads the server's output until a reply is complete.
+class Connection {
+    int _socket;
+    string _pending;
+
+public:
+    explicit Connection(int Socket) : _socket(Socket) {}
+    ~Connection() { close(_socket); }
+
+    bool send(const string &Line) {
+        const char *Data = Line.data();
+        size_t Left = Line.size();
+        while (Left) {
+            ssize_t Written = write(_socket, Data, Left);
+            if (Written <= 0) {
+                return false;
+            }
+            Data += Written;
+            Left -= Written;
+        }
+        return true;
+    }
+
+    //! awaitReply - Read until a line starting with one of the markers is complete; true on success.
+    bool awaitReply(const vector<const char *> &Markers) {
+        while (true) {
+            size_t Start = 0;
+            for (size_t End; (End = _pending.find('\n', Start)) != string::npos; Start = End + 1) {
+                // Drop any prompts in front of the line.
+                size_t Line = Start;
+                while (_pending.compare(Line, 7, "ready> ") == 0) {
+                    Line += 7;
+                }
+                for (const char *Marker : Markers) {
+                    if (_pending.compare(Line, strlen(Marker), Marker) == 0) {
+                        _pending.erase(0, End + 1);
+                        return true;
+                    }
+                }
+            }
+            _pending.erase(0, Start);
+
+            char Buffer[4096];
+            ssize_t Read = read(_socket, Buffer, sizeof(Buffer));
+            if (Read <= 0) {
+                return false;
+            }
+            _pending.append(Buffer, static_cast<size_t>(Read));
+        }
+    }
+};
+
+static int Connect(const string &Path) {
+    sockaddr_un Address;
+    memset(&Address, 0, sizeof(Address));
+    Address.sun_family = AF_UNIX;
+    strncpy(Address.sun_path, Path.c_str(), sizeof(Address.sun_path) - 1);
+
+    int Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Socket >= 0 && connect(Socket, (sockaddr *) &Address, sizeof(Address)) < 0) {
+        close(Socket);
+        return -1;
+    }
+    return Socket;
+}
+
+static string Expand(const string &Expression, unsigned Request) {
+    string Result = Expression;
+    size_t At = Result.find("%d");
+    if (At != string::npos) {
+        Result.replace(At, 2, to_string(Request));
+    }
+    return Result;
+}
+
+static void RunClient(const string &Path, const string &Setup, const string &Expression, unsigned Requests,
+                      ClientResult &Result) {
+    static const vector<const char *> Replies = {"Evaluated to", "LogError"};
+
+    auto Start = Clock::now();
+    int Socket = Connect(Path);
+    if (Socket < 0) {
+        Result.Ok = false;
+        return;
+    }
+    Connection Conn(Socket);
+
+    // The session is ready once the setup has been handled; a trivial expression marks its end.
+    if (!Conn.send(Setup + "\n0;\n") || !Conn.awaitReply({"Evaluated to"})) {
+        Result.Ok = false;
+        return;
+    }
+    Result.SetupSeconds = chrono::duration<double>(Clock::now() - Start).count();
+
+    Result.Latencies.reserve(Requests);
+    for (unsigned i = 0; i != Requests; ++i) {
+        auto Sent = Clock::now();
+        if (!Conn.send(Expand(Expression, i) + "\n") || !Conn.awaitReply(Replies)) {
+            Result.Ok = false;
+            return;
+        }
+        Result.Latencies.push_back(chrono::duration<double>(Clock::now() - Sent).count());
+    }
+}
+
+static double Percentile(const vector<double> &Sorted, double P) {
+    if (Sorted.empty()) {
+        return 0;
+    }
+    size_t Index = static_cast<size_t>(P * (Sorted.size() - 1) + 0.5);
+    return Sorted[Index];
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <socket> [-c clients] [-n requests] [-s setup] [-e expression]\n", argv[0]);
+        return 1;
+    }
+
+    string Path = argv[1];
+    unsigned Clients = 8;
+    unsigned Requests = 1000;
+    string Setup = "def poly(x) x*x*x + 2*x*x + 3*x + 4;";
+    string Expression = "poly(%d + 0.5);";
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string Flag = argv[i];
+        if (Flag == "-c") {
+            Clients = max(1ul, strtoul(argv[i + 1], nullptr, 10));
+        } else if (Flag == "-n") {
+            Requests = static_cast<unsigned>(strtoul(argv[i + 1], nullptr, 10));
+        } else if (Flag == "-s") {
+            Setup = argv[i + 1];
+        } else if (Flag == "-e") {
+            Expression = argv[i + 1];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    vector<ClientResult> Results(Clients);
+    vector<thread> Threads;
+    auto Start = Clock::now();
+    for (unsigned i = 0; i != Clients; ++i) {
+        Threads.emplace_back(RunClient, Path, Setup, Expression, Requests, ref(Results[i]));
+    }
+    for (auto &T : Threads) {
+        T.join();
+    }
+    double Seconds = chrono::duration<double>(Clock::now() - Start).count();
+
+    vector<double> Latencies;
+    double SetupSeconds = 0;
+    unsigned Failed = 0;
+    for (auto &Result : Results) {
+        Failed += !Result.Ok;
+        SetupSeconds += Result.SetupSeconds;
+        Latencies.insert(Latencies.end(), Result.Latencies.begin(), Result.Latencies.end());
+    }
+    sort(Latencies.begin(), Latencies.end());
+
+    printf("%u clients, %zu requests in %.3f s (%u failed sessions)\n",
+           Clients, Latencies.size(), Seconds, Failed);
+    printf("throughput: %.0f requests/s\n", Latencies.size() / Seconds);
+    printf("session setup: %.3f ms average\n", Clients ? 1e3 * SetupSeconds / Clients : 0.0);
+    printf("latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+           1e3 * Percentile(Latencies, 0.50),
+           1e3 * Percentile(Latencies, 0.90),
+           1e3 * Percentile(Latencies, 0.99),
+           1e3 * (Latencies.empty() ? 0.0 : Latencies.back()));
+    return Failed ? 1 : 0;
+}